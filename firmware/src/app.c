@@ -1,28 +1,138 @@
 #include "app.h"
+
+#include <util/atomic.h>
+
+#include "app_vm.h"
+#include "cube.h"
 #include "fifo.h"
+#include "usart.h"
+
+#define APP_STRINGIFY(x) #x
+#define APP_STRING(x) APP_STRINGIFY(x)
+
+// Export the limit of the global variables for the link time check
+__asm__(".global __app_globals_limit\n\t.set __app_globals_limit, " APP_STRING(APP_GLOBALS_LIMIT));
 
+// Memory arena shared by the framebuffer, the data area and the USART buffers of the running application
+uint8_t app_arena[APP_ARENA_SIZE];
 #ifndef NO_USART
-uint8_t app_recv_buffer[APP_RECV_BUFFER_SIZE];
-uint8_t app_send_buffer[APP_SEND_BUFFER_SIZE];
 fifo_t app_recv_fifo;
 fifo_t app_send_fifo;
 #endif
 
-task_func_t apps[APP_COUNT];
+app_t apps[APP_COUNT];
+
+// Data area of the running application
+uint8_t* app_data;
+
+// Rendering cost of the last frame, and the highest one
+uint32_t app_render_cycles;
+uint32_t app_render_peak;
+
+#ifndef NO_CUBE
+#define APP_FRAME_SIZE CUBE_FRAME_SIZE
+#else
+// Without the cube, frames take no memory
+#define APP_FRAME_SIZE 0
+#endif
+
+// Fills an application descriptor
+static void app_register(uint8_t app, task_func_t func, uint8_t frames, uint16_t recv_size, uint16_t send_size, uint16_t data_size) {
+	apps[app].func = func;
+	apps[app].frames = frames;
+	apps[app].recv_size = recv_size;
+	apps[app].send_size = send_size;
+	apps[app].data_size = data_size;
+}
 
 void app_tasks_init(void) {
 	// Init task descriptor
     task_init(APP_TASK, APP_STACK_START, APP_STACK_SIZE);
 
+	// Fill applications list
+	// USART buffer sizes must be powers of two
+	app_register(0, app_standby, 2, 0, 0, 0);
+	app_register(1, app_test, 14, 64, 64, 0);
+	app_register(2, app_stream, 7, 512, 64, 0);
+	app_register(3, app_vm, 7, 256, 32, APP_VM_PROGRAM_SIZE);
+	app_register(4, app_rain, 8, 16, 0, 0);
+	app_register(5, app_plasma, 8, 16, 0, 0);
+	app_register(6, app_wave, 8, 16, 0, 0);
+	app_register(7, app_spin, 8, 16, 0, 0);
+	app_register(8, app_spheres, 8, 16, 0, 0);
+	app_register(9, app_player, 8, 256, 16, 0);
+}
+
+bool app_layout(uint8_t app) {
+	const app_t* desc = &apps[app];
+	size_t size = (size_t)desc->frames * APP_FRAME_SIZE + desc->data_size + desc->recv_size + desc->send_size;
+	if(size > APP_ARENA_SIZE) {
+		return false;
+	}
+#ifndef NO_CUBE
+	if(desc->frames < CUBE_FRAME_BUFFER_MIN || desc->frames > CUBE_FRAME_BUFFER_MAX) {
+		return false;
+	}
+#endif
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint8_t* area = app_arena;
+#ifndef NO_CUBE
+		// Framebuffer comes first
+		cube_set_buffer(area, desc->frames);
+#endif
+		area += desc->frames * APP_FRAME_SIZE;
+
+		// Then the data area
+		app_data = area;
+		area += desc->data_size;
+		app_render_cycles = 0;
+		app_render_peak = 0;
+
 #ifndef NO_USART
-	// Init USART buffers
-    fifo_init(&app_recv_fifo, app_recv_buffer, APP_RECV_BUFFER_SIZE);
-	fifo_init(&app_send_fifo, app_send_buffer, APP_SEND_BUFFER_SIZE);
-	tasks[APP_TASK].recv_fifo = &app_recv_fifo;
-    tasks[APP_TASK].send_fifo = &app_send_fifo;
+		// Then the USART buffers, after stopping all traffic that uses them
+		usart_reset(USART_CHANNEL_APP);
+		fifo_t* recv_fifo = NULL;
+		fifo_t* send_fifo = NULL;
+		if(desc->recv_size > 0) {
+			fifo_init(&app_recv_fifo, area, desc->recv_size);
+			recv_fifo = &app_recv_fifo;
+			area += desc->recv_size;
+		}
+		if(desc->send_size > 0) {
+			fifo_init(&app_send_fifo, area, desc->send_size);
+			send_fifo = &app_send_fifo;
+		}
+		usart_route(USART_CHANNEL_APP, APP_TASK, recv_fifo, send_fifo);
+#ifndef NO_USART_RECV
+		if(recv_fifo != NULL) {
+			usart_set_message_mode(USART_CHANNEL_APP, true);
+		}
+#endif
 #endif
+	}
+	return true;
+}
 
-	// Fill applications list
-	apps[0] = app_standby;
-	apps[1] = app_test;
+uint8_t* app_get_data(void) {
+	return app_data;
+}
+
+void app_set_render_cycles(uint32_t cycles) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		app_render_cycles = cycles;
+		if(cycles > app_render_peak) {
+			app_render_peak = cycles;
+		}
+	}
+}
+
+void app_get_render_cycles(uint32_t* last, uint32_t* peak, bool reset) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*last = app_render_cycles;
+		*peak = app_render_peak;
+		if(reset) {
+			app_render_peak = app_render_cycles;
+		}
+	}
 }
@@ -6,6 +6,9 @@
  */
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "cpu.h"
 #include "system.h"
 #include "task.h"
@@ -14,18 +17,91 @@
 #define APP_TASK 1
 #define APP_STACK_START (SYSTEM_STACK_START - SYSTEM_STACK_SIZE)
 #define APP_STACK_SIZE (APP_STACK_START - CPU_STACK_END + 1)
-#define APP_RECV_BUFFER_SIZE 512
-#define APP_SEND_BUFFER_SIZE 64
+
+/**
+ * Minimum size of the application stack. Besides the application itself, it
+ * takes the interrupt handlers that run while the application is running,
+ * eg. the cube refresh with the frame callback, and a full context save.
+ */
+#define APP_STACK_MIN 192
+
+/**
+ * The global variables must end at or below this address, so the application
+ * stack has at least @ref APP_STACK_MIN bytes. It is checked at link time,
+ * see checks.ld.
+ */
+#define APP_GLOBALS_LIMIT (RAMEND + 1 - IDLE_STACK_SIZE - SYSTEM_STACK_SIZE - APP_STACK_MIN)
+
+/**
+ * Size of the memory arena that holds the framebuffer and the USART buffers
+ * of the running application. It is a fixed size, as the size of the other
+ * global variables is only known at link time: then checks.ld verifies that
+ * all of them end below @ref APP_GLOBALS_LIMIT, so the size has to be lowered
+ * if the link fails, and it may be raised while the link passes.
+ */
+#define APP_ARENA_SIZE 1024
 
 /// Number of implemented applications.
-#define APP_COUNT 2
+#define APP_COUNT 10
+
+/**
+ * Application descriptor.
+ * The memory needs of the application are laid out in the arena when it is
+ * started, the total size of the buffers must not exceed @ref APP_ARENA_SIZE.
+ */
+typedef struct app {
+	/// Application entry point.
+	task_func_t func;
+	/// Number of frames in the framebuffer, between @ref CUBE_FRAME_BUFFER_MIN and @ref CUBE_FRAME_BUFFER_MAX.
+	uint8_t frames;
+	/// Size of the USART receive buffer, a power of two, or 0 for none.
+	uint16_t recv_size;
+	/// Size of the USART send buffer, a power of two, or 0 for none.
+	uint16_t send_size;
+	/// Size of the application's own data area, see app_get_data().
+	uint16_t data_size;
+} app_t;
 
-/// Pointers to the application entry points.
-extern task_func_t apps[];
+/// The application descriptors.
+extern app_t apps[];
 
 /// Initializes application list.
 void app_tasks_init(void);
 
+/**
+ * Lays out the memory arena for the given application: sets up the framebuffer,
+ * the data area, and the USART buffers of the application channel. Its previous contents are
+ * discarded, the application task must be stopped when it is called.
+ *
+ * @param app Application index, less than @ref APP_COUNT.
+ * @return True if the buffers fit into the arena.
+ */
+bool app_layout(uint8_t app);
+
+/**
+ * Returns the data area of the running application in the arena.
+ * Its size is given by the application descriptor, and its contents are
+ * undefined when the application starts.
+ */
+uint8_t* app_get_data(void);
+
+/**
+ * Records how many CPU cycles it took to render a frame, for applications that
+ * render their frames themselves, see timer_get_cycles_elapsed().
+ * The figures are reset when an application is started.
+ */
+void app_set_render_cycles(uint32_t cycles);
+
+/**
+ * Returns the rendering cost of the running application.
+ *
+ * @param last Set to the cycles of the last rendered frame.
+ * @param peak Set to the most cycles of a frame since the application was
+ *     started, or the peak was reset.
+ * @param reset True to reset the peak after reading.
+ */
+void app_get_render_cycles(uint32_t* last, uint32_t* peak, bool reset);
+
 /**
  * @name Application forward declarations.
  * Do not call these directly, but via @ref apps.
@@ -34,7 +110,8 @@ void app_tasks_init(void);
 
 /**
  * This app puts the cube into standby mode by completely turning the cube off,
- * and waiting for other app to start.
+ * and waiting for other app to start. The CPU sleeps in power-down mode
+ * meanwhile, see power.h, and the LED blinks as a heartbeat.
  * App index is 0.
  */
 void app_standby(void);
@@ -46,4 +123,49 @@ void app_standby(void);
  */
 void app_test(void);
 
+/**
+ * Streaming app that displays the frames sent by the remote host.
+ * Each message of the application channel holds a whole frame, optionally
+ * preceded by its presentation time: a 16-bit little-endian timer value, and
+ * optionally by a frame id after that, which is reported in the frame events.
+ * App index is 2.
+ */
+void app_stream(void);
+
+/**
+ * Animation app that runs a bytecode program uploaded by the remote host to
+ * render the frames, see app_vm.h for the instruction set and the messages.
+ * App index is 3.
+ */
+void app_vm(void);
+
+/**
+ * @name Procedural effect apps.
+ * Each one renders an animation on its own, with parameters set on the
+ * application channel, see app_effects.h.
+ * App indices are 4 to 8.
+ */
+/// @{
+
+/// Rain drops falling from the top layer.
+void app_rain(void);
+/// Plasma of interfering sine waves.
+void app_plasma(void);
+/// Wave surface spreading from the center.
+void app_wave(void);
+/// Wireframe cube rotating around the vertical axis.
+void app_spin(void);
+/// Spheres expanding from the center.
+void app_spheres(void);
+
+/// @}
+
+/**
+ * Player app that displays the show stored in flash in a loop, without any
+ * link traffic. The show is uploaded on the application channel, see
+ * app_player.h for the format and the messages.
+ * App index is 9.
+ */
+void app_player(void);
+
 /// @}
@@ -0,0 +1,219 @@
+#include "app.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "app_effects.h"
+#include "cube.h"
+#include "draw.h"
+#include "fixmath.h"
+#include "timer.h"
+#include "usart.h"
+
+#ifndef NO_CUBE
+
+// Renders a frame of an effect at the given phase of its animation
+// The frame holds a copy of the previous one, effects may update it in place.
+typedef void (*effect_render_t)(uint8_t* frame, uint8_t phase, uint8_t size);
+
+// Squared distances of the pixels from the center along an axis, in half pixels
+static const uint8_t effect_squares[8] = { 49, 25, 9, 1, 1, 9, 25, 49 };
+
+// State of the pseudo-random generator of the rain
+static uint16_t effect_random_state = 0xACE1;
+
+// Returns a pseudo-random byte, using a 16-bit xorshift generator
+static uint8_t effect_random(void) {
+	uint16_t x = effect_random_state;
+	x ^= x << 7;
+	x ^= x >> 9;
+	x ^= x << 8;
+	effect_random_state = x;
+	return x & 0xFF;
+}
+
+// Limits a coordinate to the cube
+static uint8_t effect_clamp(int16_t value) {
+	return (value < 0) ? 0 : (value > 7) ? 7 : value;
+}
+
+// Drops fall one layer per frame, new ones appear randomly in the top layer
+static void effect_rain(uint8_t* frame, uint8_t phase, uint8_t size) {
+	(void)phase;
+	memmove(frame, frame + 8, CUBE_FRAME_SIZE - 8);
+	for(uint8_t row = 0; row < 8; row++) {
+		uint8_t bits = 0;
+		for(uint8_t column = 0; column < 8; column++) {
+			if(effect_random() < size) {
+				bits |= (1 << column);
+			}
+		}
+		frame[7 * 8 + row] = bits;
+	}
+}
+
+// Lights the zero crossings of three interfering sine waves
+static void effect_plasma(uint8_t* frame, uint8_t phase, uint8_t size) {
+	// The waves are separable, so each one is looked up once per coordinate
+	int8_t waves[3][8];
+	for(uint8_t i = 0; i < 8; i++) {
+		waves[0][i] = fix_sin(i * size + phase);
+		waves[1][i] = fix_sin(i * size - 2 * phase);
+		waves[2][i] = fix_sin(i * size + 3 * phase + FIX_TURN / 4);
+	}
+	for(uint8_t layer = 0; layer < 8; layer++) {
+		for(uint8_t row = 0; row < 8; row++) {
+			int16_t base = waves[2][layer] + waves[1][row];
+			uint8_t bits = 0;
+			for(uint8_t column = 0; column < 8; column++) {
+				int16_t value = base + waves[0][column];
+				if(value > -48 && value < 48) {
+					bits |= (1 << column);
+				}
+			}
+			frame[layer * 8 + row] = bits;
+		}
+	}
+}
+
+// Circular waves spreading from the center on a surface
+static void effect_wave(uint8_t* frame, uint8_t phase, uint8_t size) {
+	clear_frame(frame);
+	for(uint8_t row = 0; row < 8; row++) {
+		for(uint8_t column = 0; column < 8; column++) {
+			uint8_t distance = fix_sqrt(effect_squares[row] + effect_squares[column]);
+			int8_t height = fix_sin(distance * 24 - phase);
+			uint8_t layer = effect_clamp(4 + fix_scale(size, height));
+			frame[layer * 8 + row] |= (1 << column);
+		}
+	}
+}
+
+// Wireframe cube rotating around the vertical axis
+static void effect_spin(uint8_t* frame, uint8_t phase, uint8_t size) {
+	clear_frame(frame);
+	if(size < 2) {
+		size = 2;
+	} else if(size > 8) {
+		size = 8;
+	}
+	// Distance of the corners from the axis in half pixels, edge * sqrt(2) / 2
+	int16_t radius = (size * 181) >> 7;
+	uint8_t bottom = (8 - size) / 2;
+	uint8_t top = bottom + size - 1;
+	uint8_t rows[4];
+	uint8_t columns[4];
+	for(uint8_t i = 0; i < 4; i++) {
+		uint8_t angle = phase + FIX_TURN / 8 + i * (FIX_TURN / 4);
+		rows[i] = effect_clamp((7 + fix_scale(radius, fix_cos(angle)) + 1) >> 1);
+		columns[i] = effect_clamp((7 + fix_scale(radius, fix_sin(angle)) + 1) >> 1);
+	}
+	for(uint8_t i = 0; i < 4; i++) {
+		uint8_t j = (i + 1) & 3;
+		draw_line(frame, rows[i], columns[i], rows[j], columns[j], bottom);
+		draw_line(frame, rows[i], columns[i], rows[j], columns[j], top);
+		for(uint8_t layer = bottom + 1; layer < top; layer++) {
+			frame[layer * 8 + rows[i]] |= (1 << columns[i]);
+		}
+	}
+}
+
+// Two spherical shells growing from the center, half a cycle apart
+static void effect_spheres(uint8_t* frame, uint8_t phase, uint8_t size) {
+	uint16_t radius[2];
+	uint16_t inner[2];
+	uint16_t outer[2];
+	for(uint8_t i = 0; i < 2; i++) {
+		// Squared distance limits of a shell of one pixel, (r - 1)^2 and (r + 1)^2 in half pixels
+		radius[i] = ((uint16_t)(uint8_t)(phase + i * (FIX_TURN / 2)) * size) >> 8;
+		uint16_t square = radius[i] * radius[i];
+		inner[i] = (square > 2 * radius[i]) ? square - 2 * radius[i] : 0;
+		outer[i] = square + 2 * radius[i];
+	}
+	for(uint8_t layer = 0; layer < 8; layer++) {
+		for(uint8_t row = 0; row < 8; row++) {
+			uint8_t base = effect_squares[layer] + effect_squares[row];
+			uint8_t bits = 0;
+			for(uint8_t column = 0; column < 8; column++) {
+				uint16_t distance = base + effect_squares[column];
+				if((distance >= inner[0] && distance <= outer[0]) || (distance >= inner[1] && distance <= outer[1])) {
+					bits |= (1 << column);
+				}
+			}
+			frame[layer * 8 + row] = bits;
+		}
+	}
+}
+
+#if !defined(NO_USART) && !defined(NO_USART_RECV)
+// Applies the pending parameter messages
+static void app_effect_receive(uint8_t* params) {
+	uint8_t length;
+	const uint8_t* message;
+	while((message = usart_receive_message(USART_CHANNEL_APP, &length, 0)) != NULL) {
+		for(uint8_t i = 1, param = message[0]; i < length && param < APP_EFFECT_PARAM_COUNT; i++, param++) {
+			params[param] = message[i];
+		}
+		usart_release_message(USART_CHANNEL_APP);
+	}
+}
+#endif
+
+// Runs an effect with its default parameters
+static void app_effect_run(effect_render_t render, uint8_t step, uint8_t size) {
+	uint8_t params[APP_EFFECT_PARAM_COUNT] = { 1, step, size };
+	uint8_t phase = 0;
+	cube_enable();
+	uint8_t* frame = cube_advance_frame(TIMER_INFINITE);
+	clear_frame(frame);
+	for(;;) {
+#if !defined(NO_USART) && !defined(NO_USART_RECV)
+		app_effect_receive(params);
+#endif
+		uint32_t start = timer_get_cycles();
+		render(frame, phase, params[APP_EFFECT_PARAM_SIZE]);
+		app_set_render_cycles(timer_get_cycles_elapsed(start));
+		cube_hold_frame(params[APP_EFFECT_PARAM_HOLD] > 0 ? params[APP_EFFECT_PARAM_HOLD] : 1);
+		phase += params[APP_EFFECT_PARAM_STEP];
+
+		// Let the frame be displayed, and continue from its contents
+		uint8_t* next = cube_advance_frame(TIMER_INFINITE);
+		if(next != frame) {
+			memcpy(next, frame, CUBE_FRAME_SIZE);
+			frame = next;
+		}
+	}
+}
+
+#endif // NO_CUBE
+
+void app_rain(void) {
+#ifndef NO_CUBE
+	app_effect_run(effect_rain, APP_EFFECT_RAIN_STEP, APP_EFFECT_RAIN_SIZE);
+#endif
+}
+
+void app_plasma(void) {
+#ifndef NO_CUBE
+	app_effect_run(effect_plasma, APP_EFFECT_PLASMA_STEP, APP_EFFECT_PLASMA_SIZE);
+#endif
+}
+
+void app_wave(void) {
+#ifndef NO_CUBE
+	app_effect_run(effect_wave, APP_EFFECT_WAVE_STEP, APP_EFFECT_WAVE_SIZE);
+#endif
+}
+
+void app_spin(void) {
+#ifndef NO_CUBE
+	app_effect_run(effect_spin, APP_EFFECT_SPIN_STEP, APP_EFFECT_SPIN_SIZE);
+#endif
+}
+
+void app_spheres(void) {
+#ifndef NO_CUBE
+	app_effect_run(effect_spheres, APP_EFFECT_SPHERES_STEP, APP_EFFECT_SPHERES_SIZE);
+#endif
+}
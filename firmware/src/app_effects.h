@@ -0,0 +1,61 @@
+/**
+ * @file app_effects.h
+ * Parameters and messages of the built-in procedural effect apps.
+ *
+ * Each effect renders its frames from the phase of its animation, which is
+ * advanced by a configurable step after each frame, using integer and
+ * fixed-point math only, see fixmath.h. The CPU cycles spent rendering the
+ * frames are published by the system task, see SYSTEM_COMMAND_PROFILE.
+ *
+ * @copyright (C) 2018 Peter Budai
+ */
+
+#ifndef _APP_EFFECTS_H_
+#define _APP_EFFECTS_H_
+
+/**
+ * @name Parameters.
+ * They are set by application channel messages: [first parameter index][values],
+ * and they are reset to their defaults when the app is started.
+ */
+/// @{
+
+/// Number of frame periods each frame is displayed for, 0 is taken as 1. Default: 1
+#define APP_EFFECT_PARAM_HOLD 0
+/// Phase step per frame in 1/256 animation cycles, 0 freezes the animation.
+#define APP_EFFECT_PARAM_STEP 1
+/// Effect specific size, see the defaults below.
+#define APP_EFFECT_PARAM_SIZE 2
+#define APP_EFFECT_PARAM_COUNT 3
+
+/// @}
+
+/**
+ * @name Defaults.
+ */
+/// @{
+
+/// Rain moves one layer per frame, the step is not used.
+#define APP_EFFECT_RAIN_STEP 0
+/// Chance of a new drop at each pixel of the top layer, in 1/256.
+#define APP_EFFECT_RAIN_SIZE 12
+
+#define APP_EFFECT_PLASMA_STEP 4
+/// Spatial frequency of the plasma, in 1/256 turns per pixel.
+#define APP_EFFECT_PLASMA_SIZE 24
+
+#define APP_EFFECT_WAVE_STEP 8
+/// Amplitude of the wave surface, in layers.
+#define APP_EFFECT_WAVE_SIZE 3
+
+#define APP_EFFECT_SPIN_STEP 4
+/// Edge length of the rotating cube, in pixels.
+#define APP_EFFECT_SPIN_SIZE 6
+
+#define APP_EFFECT_SPHERES_STEP 4
+/// Largest radius of the expanding spheres, in half pixels.
+#define APP_EFFECT_SPHERES_SIZE 14
+
+/// @}
+
+#endif // _APP_EFFECTS_H_
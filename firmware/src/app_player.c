@@ -0,0 +1,171 @@
+#include "app.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <util/crc16.h>
+
+#include "app_player.h"
+#include "cube.h"
+#include "draw.h"
+#include "flash.h"
+#include "timer.h"
+#include "usart.h"
+
+#if !defined(NO_CUBE) && !defined(NO_FLASH)
+
+// Playback state of the stored show
+static struct {
+	bool playing;
+	// Number of frames in the show
+	uint16_t frames;
+	// Size of the frame records
+	uint16_t size;
+	// Index of the next frame
+	uint16_t frame;
+	// Storage offset of the next frame record
+	uint16_t offset;
+} player;
+
+// Reads a 16-bit value from the storage
+static uint16_t app_player_read_word(uint16_t offset) {
+	return flash_read_byte(offset) | ((uint16_t)flash_read_byte(offset + 1) << 8);
+}
+
+// Checks the stored show, and starts playing it from the beginning
+static bool app_player_start(void) {
+	player.playing = false;
+	if(flash_read_byte(0) != APP_PLAYER_MAGIC || flash_read_byte(1) != APP_PLAYER_FORMAT) {
+		return false;
+	}
+	uint16_t frames = app_player_read_word(2);
+	uint16_t size = app_player_read_word(4);
+	if(frames == 0 || size > FLASH_STORE_SIZE - APP_PLAYER_HEADER_SIZE) {
+		return false;
+	}
+	uint16_t crc = 0xFFFF;
+	for(uint16_t i = 0; i < size; i++) {
+		crc = _crc_ccitt_update(crc, flash_read_byte(APP_PLAYER_HEADER_SIZE + i));
+	}
+	if(crc != app_player_read_word(6)) {
+		return false;
+	}
+	player.frames = frames;
+	player.size = size;
+	player.frame = 0;
+	player.offset = APP_PLAYER_HEADER_SIZE;
+	player.playing = true;
+	return true;
+}
+
+// Decodes the next frame record onto the frame
+// Returns false if the record is malformed.
+static bool app_player_decode(uint8_t* frame) {
+	if(player.frame == player.frames) {
+		// Start over
+		player.frame = 0;
+		player.offset = APP_PLAYER_HEADER_SIZE;
+	}
+	if(player.frame == 0) {
+		clear_frame(frame);
+	}
+	uint16_t end = APP_PLAYER_HEADER_SIZE + player.size;
+	uint16_t offset = player.offset;
+	if(offset >= end) {
+		return false;
+	}
+	uint8_t hold = flash_read_byte(offset++);
+	cube_hold_frame(hold > 0 ? hold : 1);
+	uint8_t pos = 0;
+	while(pos < CUBE_FRAME_SIZE) {
+		if(offset >= end) {
+			return false;
+		}
+		uint8_t token = flash_read_byte(offset++);
+		if(token & APP_PLAYER_TOKEN_SKIP) {
+			pos += token - (APP_PLAYER_TOKEN_SKIP - 1);
+			continue;
+		}
+		uint8_t count = token + 1;
+		if(pos + count > CUBE_FRAME_SIZE || offset + count > end) {
+			return false;
+		}
+		while(count-- > 0) {
+			frame[pos++] ^= flash_read_byte(offset++);
+		}
+	}
+	if(pos != CUBE_FRAME_SIZE) {
+		return false;
+	}
+	player.offset = offset;
+	player.frame++;
+	return true;
+}
+
+#if !defined(NO_USART) && !defined(NO_USART_RECV)
+// Handles the pending messages, waiting for the first one for at most wait_ms
+static void app_player_receive(uint16_t wait_ms) {
+	uint8_t length;
+	const uint8_t* message;
+	while((message = usart_receive_message(USART_CHANNEL_APP, &length, wait_ms)) != NULL) {
+		uint8_t reply[3] = { message[0] };
+		uint8_t reply_length = 0;
+		switch(message[0]) {
+		case APP_PLAYER_MESSAGE_WRITE:
+			// The message is written from the receive buffer directly
+			player.playing = false;
+			reply[1] = (length > 1) ? message[1] : 0;
+			reply[2] = (length == 2 + FLASH_PAGE_SIZE && flash_write_page(message[1], message + 2)) ? APP_PLAYER_OK : APP_PLAYER_ERROR_PAGE;
+			reply_length = 3;
+			break;
+		case APP_PLAYER_MESSAGE_PLAY:
+			reply[1] = app_player_start() ? APP_PLAYER_OK : APP_PLAYER_ERROR_SHOW;
+			reply_length = 2;
+			break;
+		}
+		usart_release_message(USART_CHANNEL_APP);
+#ifndef NO_USART_SEND
+		if(reply_length > 0) {
+			usart_send_bytes(USART_CHANNEL_APP, reply, reply_length, TIMER_INFINITE);
+		}
+#endif
+		wait_ms = 0;
+	}
+}
+#else
+// Without messages, only the show stored at startup can be played
+static void app_player_receive(uint16_t wait_ms) {
+	timer_wait(wait_ms);
+}
+#endif
+
+#endif
+
+void app_player(void) {
+#if !defined(NO_CUBE) && !defined(NO_FLASH)
+	cube_enable();
+	uint8_t* frame = cube_advance_frame(TIMER_INFINITE);
+	clear_frame(frame);
+	app_player_start();
+	for(;;) {
+		// Block on messages only while there is nothing to play
+		app_player_receive(player.playing ? 0 : TIMER_INFINITE);
+		if(!player.playing) {
+			continue;
+		}
+		uint32_t start = timer_get_cycles();
+		player.playing = app_player_decode(frame);
+		app_set_render_cycles(timer_get_cycles_elapsed(start));
+		if(!player.playing) {
+			continue;
+		}
+
+		// Let the frame be displayed, the next one is decoded onto its contents
+		uint8_t* next = cube_advance_frame(TIMER_INFINITE);
+		if(next != frame) {
+			memcpy(next, frame, CUBE_FRAME_SIZE);
+			frame = next;
+		}
+	}
+#endif
+}
@@ -0,0 +1,69 @@
+/**
+ * @file app_player.h
+ * Show format and messages of the animation player app.
+ *
+ * A show is an animation stored in the flash storage area, see flash.h, which
+ * the player displays in a loop without any link traffic. It starts with a
+ * header, followed by the frame records:
+ *
+ *     [magic][format][frame count (16 bit)][data size (16 bit)][CRC (16 bit)]
+ *
+ * The CRC is CRC-16/CCITT of the frame records, reflected, starting from 0xFFFF.
+ * Multi-byte values are little-endian.
+ *
+ * Each frame record is the hold of the frame in frame periods, see
+ * cube_hold_frame(), followed by the difference from the previous frame, which
+ * is XOR-ed onto it. The first frame is compared to an empty one. Differences
+ * are run-length encoded with tokens, which cover the frame from the beginning:
+ *  - 0x00..0x7F: n + 1 literal bytes follow, to be XOR-ed onto the frame.
+ *  - 0x80..0xFF: n - 0x7F bytes are unchanged, they are skipped.
+ *
+ * @copyright (C) 2018 Peter Budai
+ */
+
+#ifndef _APP_PLAYER_H_
+#define _APP_PLAYER_H_
+
+/// First byte of a show header.
+#define APP_PLAYER_MAGIC 0x53
+/// Format version of the shows.
+#define APP_PLAYER_FORMAT 1
+/// Size of the show header.
+#define APP_PLAYER_HEADER_SIZE 8
+
+/// Token flag of unchanged bytes.
+#define APP_PLAYER_TOKEN_SKIP 0x80
+
+/**
+ * @name Application channel messages.
+ * Each request is answered with a message that starts with the same byte, and
+ * ends with a status code.
+ */
+/// @{
+
+/**
+ * Writes a page of the storage area: [0x01][page index][page bytes]
+ * Reply: [0x01][page index][status]
+ * The playback is stopped. Interrupts are disabled while the page is written,
+ * so the next message must be sent only after the reply has arrived.
+ */
+#define APP_PLAYER_MESSAGE_WRITE 0x01
+/// Starts playing the stored show from the beginning: [0x02], reply: [0x02][status]
+#define APP_PLAYER_MESSAGE_PLAY 0x02
+
+/// @}
+
+/**
+ * @name Status codes.
+ */
+/// @{
+
+#define APP_PLAYER_OK 0x00
+/// Page index out of the storage area, or wrong page size.
+#define APP_PLAYER_ERROR_PAGE 0x01
+/// No valid show is stored.
+#define APP_PLAYER_ERROR_SHOW 0x02
+
+/// @}
+
+#endif // _APP_PLAYER_H_
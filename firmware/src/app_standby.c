@@ -5,12 +5,16 @@
 #include "cpu.h"
 #include "cube.h"
 #include "led.h"
+#include "power.h"
 #include "timer.h"
 
 void app_standby(void) {
 #ifndef NO_CUBE
 	cube_disable();
 #endif
+#ifndef NO_POWER
+	power_standby_enter();
+#endif
 #ifndef NO_LED
 	for(;;) {
 		led_off();
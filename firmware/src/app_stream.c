@@ -0,0 +1,50 @@
+#include "app.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cube.h"
+#include "timer.h"
+#include "usart.h"
+
+// Sizes of the frame messages with frame id, presentation time, or both
+#define APP_STREAM_TAGGED_SIZE (CUBE_FRAME_SIZE + 1)
+#define APP_STREAM_TIMED_SIZE (CUBE_FRAME_SIZE + 2)
+#define APP_STREAM_TIMED_TAGGED_SIZE (CUBE_FRAME_SIZE + 3)
+
+void app_stream(void) {
+#if !defined(NO_CUBE) && !defined(NO_USART) && !defined(NO_USART_RECV)
+	cube_enable();
+	// Hosts may send still scenes frame by frame, do not waste frames on them
+	cube_set_dedup(true);
+	// The frame is edited first, and it is displayed when the next one is requested
+	uint8_t* frame = cube_advance_frame(TIMER_INFINITE);
+	for(;;) {
+		uint8_t length;
+		const uint8_t* message = usart_receive_message(USART_CHANNEL_APP, &length, TIMER_INFINITE);
+		if(message == NULL) {
+			continue;
+		}
+		// Messages of other sizes are not frames, drop them
+		bool valid = (length >= CUBE_FRAME_SIZE && length <= APP_STREAM_TIMED_TAGGED_SIZE);
+		if(length >= APP_STREAM_TIMED_SIZE) {
+			// Timed frame, its presentation time comes first
+			cube_set_frame_time(message[0] | ((uint16_t)message[1] << 8));
+			message += 2;
+		}
+		if(length == APP_STREAM_TAGGED_SIZE || length == APP_STREAM_TIMED_TAGGED_SIZE) {
+			// Then the frame id
+			cube_set_frame_id(message[0]);
+			message += 1;
+		}
+		if(valid) {
+			memcpy(frame, message, CUBE_FRAME_SIZE);
+		}
+		usart_release_message(USART_CHANNEL_APP);
+		if(valid) {
+			// Let the frame be displayed, and wait for room for the next one
+			frame = cube_advance_frame(TIMER_INFINITE);
+		}
+	}
+#endif
+}
@@ -29,10 +29,15 @@ void app_test(void) {
 					c = 'A';
 				}
 				font_load(f, c);
-				usart_send_bytes(f, FONT_CHAR_SIZE, 0);
+				usart_send_bytes(USART_CHANNEL_APP, f, FONT_CHAR_SIZE, 0);
 			}
 		}
-		if(usart_receive_bytes((uint8_t*)&c, 1, 125)) {
+		uint8_t length;
+		const uint8_t* message = usart_receive_message(USART_CHANNEL_APP, &length, 125);
+		if(message != NULL) {
+			// Show the first character of each message
+			c = message[0];
+			usart_release_message(USART_CHANNEL_APP);
 			font_load(f, c);
 		}
 	}
@@ -0,0 +1,280 @@
+#include "app.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "app_vm.h"
+#include "cube.h"
+#include "draw.h"
+#include "timer.h"
+#include "usart.h"
+
+#if !defined(NO_CUBE) && !defined(NO_USART) && !defined(NO_USART_RECV)
+
+// Returned by app_vm_run() when a frame is rendered, otherwise it is an error code
+#define APP_VM_FRAME 0x00
+// Returned by app_vm_run() when the program stopped
+#define APP_VM_HALT 0xFF
+
+// Interpreter state, the program itself is stored in the application data area
+static struct {
+	const uint8_t* program;
+	// Length of the loaded program, 0 if there is none
+	uint8_t size;
+	// Whether the program is running
+	bool running;
+	// Address of the next instruction
+	uint8_t pc;
+	// Address of the current instruction, reported on errors
+	uint8_t op_pc;
+	// Number of values on the stack
+	uint8_t sp;
+	uint8_t stack[APP_VM_STACK_SIZE];
+	uint8_t vars[APP_VM_VAR_COUNT];
+} vm;
+
+// Checks the stack before popping and pushing values
+#define vm_need(n) do { if(vm.sp < (n)) return APP_VM_ERROR_STACK; } while(0)
+#define vm_room(n) do { if(vm.sp + (n) > APP_VM_STACK_SIZE) return APP_VM_ERROR_STACK; } while(0)
+#define vm_pop() (vm.stack[--vm.sp])
+#define vm_push(value) (vm.stack[vm.sp++] = (value))
+
+// Whether the instruction is followed by an operand byte
+static bool app_vm_has_operand(uint8_t op) {
+	return (op >= VM_PUSH && op <= VM_STORE) || (op >= VM_JMP && op <= VM_JNZ);
+}
+
+// Executes a binary arithmetic or logic instruction
+static uint8_t app_vm_binary(uint8_t op) {
+	vm_need(2);
+	uint8_t b = vm_pop();
+	uint8_t a = vm.stack[vm.sp - 1];
+	switch(op) {
+	case VM_ADD: a += b; break;
+	case VM_SUB: a -= b; break;
+	case VM_MUL: a *= b; break;
+	case VM_MOD:
+		if(b == 0) {
+			return APP_VM_ERROR_OPERAND;
+		}
+		a %= b;
+		break;
+	case VM_AND: a &= b; break;
+	case VM_OR: a |= b; break;
+	case VM_XOR: a ^= b; break;
+	// Shifting out all bits gives 0, without relying on the width of int
+	case VM_SHL: a = (b < 8) ? (uint8_t)(a << b) : 0; break;
+	case VM_SHR: a = (b < 8) ? (a >> b) : 0; break;
+	case VM_LT: a = (a < b); break;
+	case VM_EQ: a = (a == b); break;
+	}
+	vm.stack[vm.sp - 1] = a;
+	return APP_VM_FRAME;
+}
+
+// Runs the program until it renders a frame, stops, or fails
+static uint8_t app_vm_run(uint8_t* frame) {
+	for(uint16_t budget = APP_VM_FRAME_BUDGET; budget > 0; budget--) {
+		if(vm.pc >= vm.size) {
+			vm.pc = 0;
+		}
+		vm.op_pc = vm.pc;
+		uint8_t op = vm.program[vm.pc++];
+		uint8_t arg = 0;
+		if(app_vm_has_operand(op)) {
+			if(vm.pc >= vm.size) {
+				return APP_VM_ERROR_OPERAND;
+			}
+			arg = vm.program[vm.pc++];
+		}
+
+		if(op >= VM_ADD && op <= VM_EQ) {
+			uint8_t status = app_vm_binary(op);
+			if(status != APP_VM_FRAME) {
+				return status;
+			}
+			continue;
+		}
+
+		switch(op) {
+		case VM_HALT:
+			return APP_VM_HALT;
+		case VM_PUSH:
+			vm_room(1);
+			vm_push(arg);
+			break;
+		case VM_LOAD:
+			if(arg >= APP_VM_VAR_COUNT) {
+				return APP_VM_ERROR_OPERAND;
+			}
+			vm_room(1);
+			vm_push(vm.vars[arg]);
+			break;
+		case VM_STORE:
+			if(arg >= APP_VM_VAR_COUNT) {
+				return APP_VM_ERROR_OPERAND;
+			}
+			vm_need(1);
+			vm.vars[arg] = vm_pop();
+			break;
+		case VM_DUP: {
+			vm_need(1);
+			vm_room(1);
+			uint8_t top = vm.stack[vm.sp - 1];
+			vm_push(top);
+			break;
+		}
+		case VM_DROP:
+			vm_need(1);
+			vm.sp--;
+			break;
+		case VM_SWAP: {
+			vm_need(2);
+			uint8_t top = vm.stack[vm.sp - 1];
+			vm.stack[vm.sp - 1] = vm.stack[vm.sp - 2];
+			vm.stack[vm.sp - 2] = top;
+			break;
+		}
+		case VM_OVER: {
+			vm_need(2);
+			vm_room(1);
+			uint8_t second = vm.stack[vm.sp - 2];
+			vm_push(second);
+			break;
+		}
+		case VM_JMP:
+		case VM_JZ:
+		case VM_JNZ: {
+			if(arg >= vm.size) {
+				return APP_VM_ERROR_OPERAND;
+			}
+			bool jump = true;
+			if(op != VM_JMP) {
+				vm_need(1);
+				jump = ((vm_pop() == 0) == (op == VM_JZ));
+			}
+			if(jump) {
+				vm.pc = arg;
+			}
+			break;
+		}
+		case VM_CLEAR:
+			clear_frame(frame);
+			break;
+		case VM_PIXEL:
+		case VM_UNPIXEL: {
+			vm_need(3);
+			uint8_t layer = vm_pop() & 7;
+			uint8_t column = vm_pop() & 7;
+			uint8_t row = vm_pop() & 7;
+			set_pixel(frame, row, column, layer, op == VM_PIXEL);
+			break;
+		}
+		case VM_ROW: {
+			vm_need(3);
+			uint8_t layer = vm_pop() & 7;
+			uint8_t row = vm_pop() & 7;
+			frame[layer * 8 + row] = vm_pop();
+			break;
+		}
+		case VM_PLANE: {
+			vm_need(3);
+			uint8_t n = vm_pop() & 7;
+			uint8_t plane = vm_pop();
+			uint8_t bits = vm_pop();
+			if(plane > LAYERS) {
+				return APP_VM_ERROR_OPERAND;
+			}
+			uint8_t value[8];
+			memset(value, bits, sizeof(value));
+			set_plane(frame, plane, n, value);
+			break;
+		}
+		case VM_FRAME:
+			return APP_VM_FRAME;
+		case VM_HOLD: {
+			vm_need(1);
+			uint8_t periods = vm_pop();
+			cube_hold_frame(periods > 0 ? periods : 1);
+			break;
+		}
+		default:
+			return APP_VM_ERROR_OPCODE;
+		}
+	}
+	return APP_VM_ERROR_BUDGET;
+}
+
+// Handles a message from the remote host
+static void app_vm_handle(const uint8_t* message, uint8_t length, uint8_t* frame) {
+	switch(message[0]) {
+	case APP_VM_MESSAGE_LOAD:
+		// Load the program into the data area, and start it from a clean state
+		vm.size = length - 1;
+		memcpy(app_get_data(), message + 1, vm.size);
+		vm.running = (vm.size > 0);
+		vm.pc = 0;
+		vm.sp = 0;
+		memset(vm.vars, 0, sizeof(vm.vars));
+		clear_frame(frame);
+		break;
+	case APP_VM_MESSAGE_SET:
+		if(length >= 2) {
+			for(uint8_t i = 2, var = message[1]; i < length && var < APP_VM_VAR_COUNT; i++, var++) {
+				vm.vars[var] = message[i];
+			}
+		}
+		break;
+	}
+}
+
+// Handles the pending messages, waiting for the first one for at most wait_ms
+static void app_vm_receive(uint8_t* frame, uint16_t wait_ms) {
+	uint8_t length;
+	const uint8_t* message;
+	while((message = usart_receive_message(USART_CHANNEL_APP, &length, wait_ms)) != NULL) {
+		app_vm_handle(message, length, frame);
+		usart_release_message(USART_CHANNEL_APP);
+		wait_ms = 0;
+	}
+}
+
+#endif
+
+void app_vm(void) {
+#if !defined(NO_CUBE) && !defined(NO_USART) && !defined(NO_USART_RECV)
+	vm.program = app_get_data();
+	vm.size = 0;
+	vm.running = false;
+	cube_enable();
+	uint8_t* frame = cube_advance_frame(TIMER_INFINITE);
+	clear_frame(frame);
+	for(;;) {
+		// Block on messages only while there is no program to run
+		app_vm_receive(frame, vm.running ? 0 : TIMER_INFINITE);
+		if(!vm.running) {
+			continue;
+		}
+		uint32_t start = timer_get_cycles();
+		uint8_t status = app_vm_run(frame);
+		app_set_render_cycles(timer_get_cycles_elapsed(start));
+		if(status == APP_VM_FRAME) {
+			// Let the frame be displayed, and continue from its contents
+			uint8_t* next = cube_advance_frame(TIMER_INFINITE);
+			if(next != frame) {
+				memcpy(next, frame, CUBE_FRAME_SIZE);
+				frame = next;
+			}
+			continue;
+		}
+		vm.running = false;
+#ifndef NO_USART_SEND
+		if(status != APP_VM_HALT) {
+			uint8_t error[3] = { APP_VM_MESSAGE_ERROR, status, vm.op_pc };
+			usart_send_bytes(USART_CHANNEL_APP, error, sizeof(error), 0);
+		}
+#endif
+	}
+#endif
+}
@@ -0,0 +1,114 @@
+/**
+ * @file app_vm.h
+ * Instruction set and messages of the animation bytecode interpreter app.
+ *
+ * The program is a sequence of one-byte instructions, some of them followed by
+ * a one-byte operand. It works on a stack of 8-bit values, and it has a set of
+ * 8-bit variables that keep their values between frames, so they can be used
+ * as animation state, or as parameters set by the remote host.
+ *
+ * The program is run from its beginning, and it renders into the edited frame.
+ * The FRAME instruction queues the rendered frame for display and waits for the
+ * next one, which starts as a copy of the queued frame, so it can be updated
+ * incrementally. Then the program continues with the next instruction, and
+ * running past the end of the program starts it over again. All arithmetic
+ * wraps around at 256.
+ *
+ * @copyright (C) 2018 Peter Budai
+ */
+
+#ifndef _APP_VM_H_
+#define _APP_VM_H_
+
+/// Maximum size of a program, jump targets are 8-bit addresses.
+#define APP_VM_PROGRAM_SIZE 256
+/// Depth of the value stack.
+#define APP_VM_STACK_SIZE 16
+/// Number of variables.
+#define APP_VM_VAR_COUNT 16
+/// Maximum number of instructions between two FRAME instructions.
+#define APP_VM_FRAME_BUDGET 4096
+
+/**
+ * @name Instructions.
+ * Stack effects are shown as (before -- after), the top of the stack is on the right.
+ */
+/// @{
+
+/// Stops the program until a new one is loaded, the queued frames are still displayed. ( -- )
+#define VM_HALT 0x00
+/// Pushes the operand byte. ( -- n )
+#define VM_PUSH 0x01
+/// Pushes the value of the variable given by the operand byte. ( -- v )
+#define VM_LOAD 0x02
+/// Stores a value in the variable given by the operand byte. ( v -- )
+#define VM_STORE 0x03
+
+#define VM_ADD 0x10 ///< ( a b -- a+b )
+#define VM_SUB 0x11 ///< ( a b -- a-b )
+#define VM_MUL 0x12 ///< ( a b -- a*b )
+#define VM_MOD 0x13 ///< ( a b -- a%b ), b must not be 0
+#define VM_AND 0x14 ///< ( a b -- a&b )
+#define VM_OR 0x15 ///< ( a b -- a|b )
+#define VM_XOR 0x16 ///< ( a b -- a^b )
+#define VM_SHL 0x17 ///< ( a b -- a<<b )
+#define VM_SHR 0x18 ///< ( a b -- a>>b )
+#define VM_LT 0x19 ///< ( a b -- a<b ), 1 if true, 0 otherwise
+#define VM_EQ 0x1A ///< ( a b -- a==b ), 1 if true, 0 otherwise
+#define VM_DUP 0x1B ///< ( a -- a a )
+#define VM_DROP 0x1C ///< ( a -- )
+#define VM_SWAP 0x1D ///< ( a b -- b a )
+#define VM_OVER 0x1E ///< ( a b -- a b a )
+
+/// Jumps to the operand address. ( -- )
+#define VM_JMP 0x20
+/// Jumps to the operand address if the value is zero. ( v -- )
+#define VM_JZ 0x21
+/// Jumps to the operand address if the value is not zero. ( v -- )
+#define VM_JNZ 0x22
+
+/// Clears the frame. ( -- )
+#define VM_CLEAR 0x30
+/// Lights a pixel, coordinates are taken modulo 8. ( row column layer -- )
+#define VM_PIXEL 0x31
+/// Turns off a pixel, coordinates are taken modulo 8. ( row column layer -- )
+#define VM_UNPIXEL 0x32
+/// Sets the bits of a row in a layer directly. ( bits row layer -- )
+#define VM_ROW 0x33
+/// Sets a whole plane to the same 8 bits in each line, see set_plane(). ( bits plane n -- )
+#define VM_PLANE 0x34
+
+/// Queues the frame for display, and waits for the next one. ( -- )
+#define VM_FRAME 0x40
+/// Sets how many frame periods the frame is displayed for, see cube_hold_frame(), 0 is taken as 1. ( n -- )
+#define VM_HOLD 0x41
+
+/// @}
+
+/**
+ * @name Application channel messages.
+ */
+/// @{
+
+/// Loads and starts a program: [0x01][program bytes], the variables are cleared.
+#define APP_VM_MESSAGE_LOAD 0x01
+/// Sets variables: [0x02][first variable index][values]
+#define APP_VM_MESSAGE_SET 0x02
+/// Sent when the program stopped with an error: [0xEE][error code][address]
+#define APP_VM_MESSAGE_ERROR 0xEE
+
+/// @}
+
+/**
+ * @name Error codes.
+ */
+/// @{
+
+#define APP_VM_ERROR_OPCODE 0x01 ///< Unknown instruction
+#define APP_VM_ERROR_STACK 0x02 ///< Stack overflow or underflow
+#define APP_VM_ERROR_OPERAND 0x03 ///< Invalid operand, or division by zero
+#define APP_VM_ERROR_BUDGET 0x04 ///< Too many instructions between frames
+
+/// @}
+
+#endif // _APP_VM_H_
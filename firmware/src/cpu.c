@@ -1,14 +1,57 @@
 #include "cpu.h"
 
+#include <string.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include <avr/wdt.h>
 #include <util/atomic.h>
 
+// Check value of a valid crash record is computed from this
+#define CPU_CRASH_CHECK 0xC7A5
+
+// Both are outside of the initialized RAM: the flags are captured before the
+// variables are initialized, and the record has to survive resets
+uint8_t cpu_reset_flags __attribute__((section(".noinit")));
+cpu_crash_record_t cpu_crash_record __attribute__((section(".noinit")));
+
+// Returns the check value of the crash record
+static uint16_t cpu_crash_check(void) {
+	return CPU_CRASH_CHECK ^ cpu_crash_record.reason ^ ((uint16_t)cpu_crash_record.task << 8)
+		^ cpu_crash_record.sp ^ cpu_crash_record.time;
+}
+
 void cpu_init(void) {
-	// Clear reset flag and disable watchdog, so it won't reset again in 15 ms
+	// Keep the reset source, then clear reset flag and disable watchdog, so it
+	// won't reset again in 15 ms
+	cpu_reset_flags = MCUSR;
 	MCUSR = 0;
 	wdt_disable();
+	// The RAM contents are random after power loss
+	if(cpu_reset_flags & ((1 << PORF) | (1 << BORF))) {
+		cpu_crash_record.check = ~cpu_crash_check();
+	}
+}
+
+void cpu_crash(uint8_t reason, uint8_t task, uint16_t sp, uint16_t time) {
+	cpu_crash_record.reason = reason;
+	cpu_crash_record.task = task;
+	cpu_crash_record.sp = sp;
+	cpu_crash_record.time = time;
+	cpu_crash_record.check = cpu_crash_check();
+	cpu_reset();
+}
+
+void cpu_get_crash(cpu_crash_record_t* record, bool clear) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if(cpu_crash_record.check == cpu_crash_check()) {
+			memcpy(record, &cpu_crash_record, sizeof(cpu_crash_record_t));
+		} else {
+			memset(record, 0, sizeof(cpu_crash_record_t));
+		}
+		if(clear) {
+			cpu_crash_record.check = ~cpu_crash_check();
+		}
+	}
 }
 
 void cpu_reset(void) {
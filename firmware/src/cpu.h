@@ -8,6 +8,8 @@
 #ifndef _CPU_H_
 #define _CPU_H_
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <avr/io.h>
 
 // The linker defines this pseudo symbol that is located after all global variables.
@@ -24,6 +26,60 @@ void cpu_init(void) __attribute__((naked, section(".init3")));
 
 /// Properly resets the microcontroller using the watchdog timer.
 void cpu_reset(void) __attribute__((noreturn));
+
+/**
+ * @name Crash reasons.
+ */
+/// @{
+
+/// No crash was recorded since power-on.
+#define CPU_CRASH_NONE 0x00
+/// The stack canary of a task was overwritten.
+#define CPU_CRASH_STACK 0x01
+/// No task was runnable, not even the idle task.
+#define CPU_CRASH_DEADLOCK 0x02
+
+/// @}
+
+/**
+ * Record of the last crash.
+ * It is kept in RAM that is not initialized at startup, so it survives the
+ * reset that follows the crash. It is cleared at power-on and brown-out resets.
+ */
+typedef struct cpu_crash_record {
+	/// Crash reason, see CPU_CRASH_NONE and the others.
+	uint8_t reason;
+	/// Task that was switched to, or from if there was none.
+	uint8_t task;
+	/// Stack pointer of that task.
+	uint16_t sp;
+	/// Timer value at the crash.
+	uint16_t time;
+	/// Check value of the fields above, to tell a record from random RAM contents.
+	uint16_t check;
+} cpu_crash_record_t;
+
+/// Contents of the MCU status register at the last reset, it tells the reset source.
+extern uint8_t cpu_reset_flags;
+
+/**
+ * Records a crash, then resets the microcontroller.
+ *
+ * @param reason Crash reason, see CPU_CRASH_STACK and the others.
+ * @param task Task involved in the crash.
+ * @param sp Stack pointer of that task.
+ * @param time Timer value.
+ */
+void cpu_crash(uint8_t reason, uint8_t task, uint16_t sp, uint16_t time) __attribute__((noreturn));
+
+/**
+ * Returns the record of the last crash.
+ *
+ * @param record Set to the record, its reason is @ref CPU_CRASH_NONE if no
+ *     crash was recorded.
+ * @param clear True to clear the record after reading.
+ */
+void cpu_get_crash(cpu_crash_record_t* record, bool clear);
 /// Properly halts the microcontroller.
 /// This is the last code to be executed while the CPU is running.
 void cpu_halt(void) __attribute__((noreturn, naked, section(".fini0")));
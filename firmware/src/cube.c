@@ -3,7 +3,9 @@
 #ifndef NO_CUBE
 
 #include <stdlib.h>
+#include <string.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <util/atomic.h>
 
 #include "cpu.h"
@@ -17,7 +19,7 @@
 #define ROWL_PORT PORTC
 #define ROWL_MASK ((1 << PORTC3) | (1 << PORTC2) | (1 << PORTC1) | (1 << PORTC0))
 
-#define ENABLE_PORT PORTD
+// The enable pin is OC2B, it is driven by Timer2
 #define ENABLE_BIT (1 << PORTD3)
 
 #define SHIFT_PORT PORTC
@@ -28,9 +30,18 @@
 #define LAYER_PORT PORTB
 #define LAYER_MASK ((1 << PORTB2) | (1 << PORTB1) | (1 << PORTB0))
 
+// Compare output modes of the enable pin, it is active low
+#define ENABLE_OFF_MODE ((1 << COM2B1) | (1 << COM2B0))
+#define ENABLE_ON_MODE (1 << COM2B1)
+
 // Macros for dealing with output ports.
-#define enable_off() ENABLE_PORT |= ENABLE_BIT
-#define enable_on() ENABLE_PORT &= ~ENABLE_BIT
+// The enable pin is switched by forcing a compare match, which stops Timer2
+#define enable_off() \
+	TCCR2A = ENABLE_OFF_MODE; \
+	TCCR2B = (1 << FOC2B)
+#define enable_on() \
+	TCCR2A = ENABLE_ON_MODE; \
+	TCCR2B = (1 << FOC2B)
 
 #define shift() \
 	SHIFT_PORT |= SHIFT_BIT; \
@@ -39,45 +50,198 @@
 	STORE_PORT |= STORE_BIT; \
 	STORE_PORT &= ~(STORE_BIT)
 
+// Refresh timer clock source divider
+#define CUBE_TIMER_PRESCALER 8
+#define CUBE_TIMER_CLOCK ((1 << WGM12) | (1 << CS11))
+// Converts microseconds to refresh timer counts, and back
+#define cube_timer_counts(us) ((uint32_t)(us) * (F_CPU / 1000000UL) / CUBE_TIMER_PRESCALER)
+#define cube_timer_us(counts) ((uint32_t)(counts) * CUBE_TIMER_PRESCALER / (F_CPU / 1000000UL))
+
+// Number of Timer2 clock sources, its prescalers are 1, 8, 32, 64, 128, 256 and 1024
+#define CUBE_ON_CLOCKS 7
+
 #define layer_select(l) LAYER_PORT = (LAYER_PORT & ~(LAYER_MASK)) | ((l) & LAYER_MASK)
 #define layer_address(l) ((l) * 8)
 
 // Helper macros
 #define frame_address(f) (frame_buffer + (f) * CUBE_FRAME_SIZE)
-#define frame_next(f) ((f) >= CUBE_FRAME_BUFFER_COUNT - 1 ? 0 : (f) + 1)
+#define frame_next(f) ((f) >= frame_count - 1 ? 0 : (f) + 1)
+#define frame_prev(f) ((f) == 0 ? frame_count - 1 : (f) - 1)
+#define frame_is_timed(f) (frame_timed & (1U << (f)))
+#define frame_is_due(f) ((int16_t)(timer_get_current_unsafe() - frame_times[f]) >= 0)
 
 // Global variables
-uint8_t frame_buffer[CUBE_FRAME_SIZE * CUBE_FRAME_BUFFER_COUNT];
+uint8_t* frame_buffer;
+uint8_t frame_count;
 uint8_t current_layer;
 uint8_t current_repeat;
+uint8_t frame_repeat;
+// Number of additional frame periods each frame is displayed for
+uint8_t frame_holds[CUBE_FRAME_BUFFER_MAX];
+uint8_t current_hold;
+// Presentation times of the timed frames, which are flagged in a bitmask
+uint16_t frame_times[CUBE_FRAME_BUFFER_MAX];
+uint16_t frame_timed;
+// Identifiers of the frames set by their producer
+uint8_t frame_ids[CUBE_FRAME_BUFFER_MAX];
+bool dedup;
+// True if the newest frame is displayed next, skipping the older ones
+bool latest;
 uint8_t current_frame;
 uint8_t edited_frame;
 bool enabled;
+// Overlays composited onto the displayed frame, in index order
+const uint8_t* overlay_buffers[CUBE_OVERLAY_COUNT];
+cube_blend_t overlay_modes[CUBE_OVERLAY_COUNT];
+// Virtual canvas displayed instead of the frames, if it is not NULL
+const uint8_t* canvas;
+uint8_t canvas_width;
+uint8_t canvas_offset;
+// The last frame switch, and the callback to notify about the next ones
+cube_frame_event_t frame_event;
+cube_frame_callback_t frame_callback;
+// Layer period in microseconds
+uint16_t layer_period;
+// Brightness level and power limit, see cube_set_brightness()
+uint8_t brightness;
+uint8_t power_limit;
+// Timer2 clock source that times the on-time, and its counts in a layer period
+uint8_t on_clock;
+uint8_t on_period;
+// Number of Timer2 counts each layer is lit for, the period means all of it
+uint8_t on_counts;
+// Lit voxels counted in the current frame period, and in the last one
+uint16_t counted_voxels;
+uint16_t lit_voxels;
+// Earliest and latest start of the refresh after the compare match, in refresh timer counts
+uint16_t latency_min;
+uint16_t latency_max;
 
-bool cube_refresh(void) {
-	// When cube is turned off, do not consume resources
-	if(!enabled) {
-		return false;
+static bool cube_refresh(void);
+
+/// Refresh timer interrupt handler, called once per layer period.
+ISR(TIMER1_COMPA_vect) {
+	// The task switches deferred by the other interrupt handlers are done here,
+	// after the layer is displayed, so they do not delay the refresh
+	if(cube_refresh() || task_take_deferred_unsafe()) {
+		task_schedule_unsafe();
+	}
+}
+
+// Binary logarithms of the Timer2 prescalers
+static const uint8_t cube_on_prescaler_shifts[CUBE_ON_CLOCKS] = { 0, 3, 5, 6, 7, 8, 10 };
+
+// Returns the number of set bits
+static uint8_t cube_count_bits(uint8_t bits) {
+	bits = bits - ((bits >> 1) & 0x55);
+	bits = (bits & 0x33) + ((bits >> 2) & 0x33);
+	return (bits + (bits >> 4)) & 0x0F;
+}
+
+// Updates the on-time of the layers from the brightness and the power limit
+static void cube_update_on_counts_unsafe(void) {
+	uint16_t counts = on_period;
+	if(brightness < CUBE_BRIGHTNESS_MAX) {
+		counts = ((uint32_t)counts * brightness) >> 8;
+	}
+	// The limit is for all 8 layers
+	uint16_t limit = (uint16_t)power_limit * 8;
+	if(limit > 0 && lit_voxels > limit) {
+		counts = (uint32_t)counts * limit / lit_voxels;
+	}
+	on_counts = counts;
+}
+
+// Combines a layer of an overlay into the composed layer
+static void cube_blend_layer(uint8_t* layer, const uint8_t* overlay, cube_blend_t mode) {
+	// The mode is checked once per layer, not for each row
+	switch(mode) {
+		case CUBE_BLEND_OR:
+			for(uint8_t row = 0; row < 8; row++) {
+				layer[row] |= overlay[row];
+			}
+			break;
+		case CUBE_BLEND_XOR:
+			for(uint8_t row = 0; row < 8; row++) {
+				layer[row] ^= overlay[row];
+			}
+			break;
+		case CUBE_BLEND_MASK:
+			for(uint8_t row = 0; row < 8; row++) {
+				layer[row] &= overlay[row];
+			}
+			break;
+		case CUBE_BLEND_CLEAR:
+			for(uint8_t row = 0; row < 8; row++) {
+				layer[row] &= ~overlay[row];
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+// Records a frame switch, notifies the callback and wakes up tasks waiting
+// for cube, returns true if there was any
+static bool cube_frame_switched_unsafe(void) {
+	frame_event.sequence++;
+	frame_event.time = timer_get_current_unsafe();
+	frame_event.id = frame_ids[current_frame];
+	bool wake = false;
+	if(frame_callback != NULL) {
+		wake = frame_callback(&frame_event);
+	}
+	for(uint8_t i = 0; i < TASK_COUNT; ++i) {
+		if(tasks[i].status & TASK_WAIT_CUBE) {
+			tasks[i].status &= ~TASK_WAITING;
+			wake = true;
+		}
+	}
+	return wake;
+}
+
+// Composes the current layer of the current frame or the canvas, and the
+// overlays, and shifts it into the column registers without displaying it
+static void cube_shift_layer_unsafe(void) {
+	uint8_t layer[8];
+	if(canvas == NULL) {
+		memcpy(layer, frame_address(current_frame) + layer_address(current_layer), 8);
+	} else {
+		// The window starts at the scroll offset, and wraps around at the end of the canvas
+		const uint8_t* canvas_layer = canvas + (uint16_t)current_layer * canvas_width;
+		uint8_t index = canvas_offset;
+		for(uint8_t row = 0; row < 8; row++) {
+			layer[row] = canvas_layer[index];
+			if(++index >= canvas_width) {
+				index = 0;
+			}
+		}
+	}
+	for(uint8_t i = 0; i < CUBE_OVERLAY_COUNT; ++i) {
+		if(overlay_modes[i] != CUBE_BLEND_OFF) {
+			cube_blend_layer(layer, overlay_buffers[i] + layer_address(current_layer), overlay_modes[i]);
+		}
+	}
+	if(power_limit > 0) {
+		for(uint8_t row = 0; row < 8; row++) {
+			counted_voxels += cube_count_bits(layer[row]);
+		}
 	}
 
-	// Display the current layer of the current frame
-	uint8_t* layer = frame_address(current_frame) + layer_address(current_layer);
-	enable_off();
-	layer_select(current_layer);
 	for(uint8_t row = 0; row < 8; row++) {
 		uint8_t columns = layer[row];
 		ROWH_PORT = (ROWH_PORT & ~(ROWH_MASK)) | (columns & ROWH_MASK);
 		ROWL_PORT = (ROWL_PORT & ~(ROWL_MASK)) | (columns & ROWL_MASK);
 		shift();
 	}
-	store();
-	enable_on();
+}
 
-	// Advance to the next layer, iteration or frame
-	// Assuming that this function is called once per milliseconds, a full frame
-	// requires 8 ms to display once, but will be repeteated before the next
-	// frame comes in every 40 ms, thus we get a nice 25 Hz frame rate which
-	// suits well for displaying fluid animations.
+// Advances to the next layer, iteration or frame, returns true if a task was woken up
+static bool cube_advance_layer_unsafe(void) {
+	// With the default 1 ms layer period, a full frame requires 8 ms to display
+	// once, but will be repeteated before the next frame comes in every 40 ms,
+	// thus we get a nice 25 Hz frame rate which suits well for displaying fluid
+	// animations.
 
 	// Going through all layers
 	current_layer++;
@@ -85,29 +249,92 @@ bool cube_refresh(void) {
 		return false;
 	}
 	current_layer = 0;
+	lit_voxels = counted_voxels;
+	counted_voxels = 0;
+	cube_update_on_counts_unsafe();
 
-	// Each full frame is repeated 5 times to help the image stabilize visually
-	current_repeat++;
-	if(current_repeat < 5) {
-		return false;
+	uint8_t next_frame = frame_next(current_frame);
+	if(next_frame != edited_frame && frame_is_timed(next_frame)) {
+		// A timed frame is displayed as soon as its time has come, regardless of
+		// the repeats and the hold of the current frame
+		if(!frame_is_due(next_frame)) {
+			return false;
+		}
+	} else {
+		// Each full frame is repeated (5 times by default) to help the image
+		// stabilize visually
+		current_repeat++;
+		if(current_repeat < frame_repeat) {
+			return false;
+		}
+
+		// Held frames are displayed for more frame periods
+		if(current_hold < frame_holds[current_frame]) {
+			current_repeat = 0;
+			current_hold++;
+			return false;
+		}
+
+		// If there are no more frames to display, the last one will be freezed
+		if(next_frame == edited_frame) {
+			current_repeat = 0;
+			return false;
+		}
+	}
+	if(latest) {
+		// Skip to the newest frame, the older ones are freed as well, unless it
+		// is timed, and its time has not come yet
+		uint8_t newest_frame = frame_prev(edited_frame);
+		if(!frame_is_timed(newest_frame) || frame_is_due(newest_frame)) {
+			next_frame = newest_frame;
+		}
 	}
+	current_frame = next_frame;
 	current_repeat = 0;
+	current_hold = 0;
 
-	// If there are no more frames to display, the last one will be freezed
-	uint8_t next_frame = frame_next(current_frame);
-	if(next_frame == edited_frame) {
+	// Successful frame switch: wake up tasks waiting for cube
+	return cube_frame_switched_unsafe();
+}
+
+// Displays the next layer, returns true if a task was woken up
+static bool cube_refresh(void) {
+	// When cube is turned off, do not consume resources
+	if(!enabled) {
 		return false;
 	}
-	current_frame = next_frame;
 
-	// Successful frame switch: wake up tasks waiting for cube
-	bool wake = false;
-	for(uint8_t i = 0; i < TASK_COUNT; ++i) {
-		if(tasks[i].status & TASK_WAIT_CUBE) {
-			tasks[i].status &= ~TASK_WAITING;
-			wake = true;
+	// How late the refresh is, it is 0 at the compare match
+	uint16_t latency = TCNT1;
+
+	// Display the layer that was shifted in by the previous refresh right away,
+	// so its start does not depend on how long composing it takes
+	enable_off();
+	layer_select(current_layer);
+	store();
+	if(on_counts > 0) {
+		enable_on();
+		if(on_counts < on_period) {
+			// The compare match ends the on-time in hardware, so its length
+			// does not depend on the interrupt latency. Timer2 starts from a
+			// reset prescaler a fixed number of cycles after the layer is on.
+			TCNT2 = 0;
+			OCR2B = on_counts;
+			TCCR2A = ENABLE_OFF_MODE;
+			GTCCR = (1 << PSRASY);
+			TCCR2B = on_clock;
 		}
 	}
+	if(latency < latency_min) {
+		latency_min = latency;
+	}
+	if(latency > latency_max) {
+		latency_max = latency;
+	}
+
+	// Prepare the next layer while this one is displayed
+	bool wake = cube_advance_layer_unsafe();
+	cube_shift_layer_unsafe();
 	return wake;
 }
 
@@ -117,12 +344,70 @@ void cube_init(void)
 	DDRB |= LAYER_MASK;
 	DDRC |= (ROWL_MASK | SHIFT_BIT | STORE_BIT);
 	DDRD |= (ROWH_MASK | ENABLE_BIT);
+	enable_off();
 
-	// Start with an empty frame
+	// The framebuffer is set up later
 	enabled = false;
-	current_frame = 0;
-	edited_frame = 1;
-	clear_frame(frame_address(current_frame));
+	frame_repeat = CUBE_DEFAULT_REPEAT;
+	frame_buffer = NULL;
+	frame_count = 0;
+	frame_event.sequence = 0;
+	frame_event.time = 0;
+	frame_event.id = 0;
+	frame_callback = NULL;
+	canvas = NULL;
+	for(uint8_t i = 0; i < CUBE_OVERLAY_COUNT; ++i) {
+		overlay_buffers[i] = NULL;
+		overlay_modes[i] = CUBE_BLEND_OFF;
+	}
+	dedup = false;
+	latest = false;
+	brightness = CUBE_BRIGHTNESS_MAX;
+	power_limit = 0;
+	lit_voxels = 0;
+	counted_voxels = 0;
+	latency_min = UINT16_MAX;
+	latency_max = 0;
+
+	// Set CTC mode for the refresh timer, it is started by cube_enable()
+	TCCR1A = 0;
+	TCCR1B = (1 << WGM12);
+	TIMSK1 = (1 << OCIE1A);
+	cube_set_layer_period(CUBE_DEFAULT_LAYER_PERIOD);
+}
+
+void cube_set_buffer(uint8_t* buffer, uint8_t count) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// Start with an empty frame
+		frame_buffer = buffer;
+		frame_count = count;
+		current_layer = 0;
+		current_repeat = 0;
+		current_hold = 0;
+		dedup = false;
+		latest = false;
+		current_frame = 0;
+		edited_frame = 1;
+		frame_holds[current_frame] = 0;
+		frame_holds[edited_frame] = 0;
+		frame_ids[current_frame] = 0;
+		frame_ids[edited_frame] = 0;
+		frame_timed = 0;
+		canvas = NULL;
+		for(uint8_t i = 0; i < CUBE_OVERLAY_COUNT; ++i) {
+			overlay_modes[i] = CUBE_BLEND_OFF;
+		}
+		// The edited frame is queued by the first cube_advance_frame() of the
+		// application, so it must not show the previous contents of the arena
+		clear_frame(frame_address(current_frame));
+		clear_frame(frame_address(edited_frame));
+		// Replace the layer shifted in from the previous framebuffer
+		cube_shift_layer_unsafe();
+	}
+}
+
+uint8_t cube_get_buffer_count(void) {
+	return frame_count;
 }
 
 void cube_enable(void)
@@ -131,37 +416,298 @@ void cube_enable(void)
 		// Start with a whole frame, cube will be enabled when the timer fires
 		current_layer = 0;
 		current_repeat = 0;
+		cube_shift_layer_unsafe();
 		// Turn on timer event processing
 		enabled = true;
+		TCNT1 = 0;
+		TCCR1B = CUBE_TIMER_CLOCK;
+		// Wake-ups of the other interrupt handlers are scheduled by the refresh
+		task_set_deferral_unsafe(true);
 	}
 }
 
 void cube_disable(void)
 {
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		// Turn off timer event processing
+		// Turn off timer event processing, the timer is stopped so it does not
+		// wake up the CPU at all
 		enabled = false;
-		// Turn off cube outputs
+		TCCR1B = (1 << WGM12);
+		TIFR1 = (1 << OCF1A);
+		// Turn off cube outputs, this stops Timer2 as well
 		enable_off();
+		task_set_deferral_unsafe(false);
+	}
+}
+
+void cube_set_overlay(uint8_t index, const uint8_t* buffer, cube_blend_t mode) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		overlay_buffers[index] = buffer;
+		overlay_modes[index] = (buffer != NULL) ? mode : CUBE_BLEND_OFF;
+	}
+}
+
+void cube_set_canvas(const uint8_t* buffer, uint8_t width) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		canvas = buffer;
+		canvas_width = width;
+		canvas_offset = 0;
+	}
+}
+
+void cube_scroll(uint8_t offset) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		canvas_offset = (canvas_width > 0) ? offset % canvas_width : 0;
+	}
+}
+
+void cube_set_repeat(uint8_t repeat) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		frame_repeat = (repeat > 0) ? repeat : 1;
+	}
+}
+
+uint8_t cube_get_repeat(void) {
+	return frame_repeat;
+}
+
+void cube_set_layer_period(uint16_t period) {
+	if(period < CUBE_LAYER_PERIOD_MIN) {
+		period = CUBE_LAYER_PERIOD_MIN;
+	} else if(period > CUBE_LAYER_PERIOD_MAX) {
+		period = CUBE_LAYER_PERIOD_MAX;
+	}
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		layer_period = period;
+		OCR1A = cube_timer_counts(period) - 1;
+		// Time the on-time with the finest Timer2 prescaler that spans the period
+		uint32_t cycles = (uint32_t)period * (F_CPU / 1000000UL);
+		uint8_t clock = 1;
+		while(clock < CUBE_ON_CLOCKS && (cycles >> cube_on_prescaler_shifts[clock - 1]) > UINT8_MAX) {
+			clock++;
+		}
+		cycles >>= cube_on_prescaler_shifts[clock - 1];
+		on_clock = clock;
+		on_period = (cycles > UINT8_MAX) ? UINT8_MAX : cycles;
+		// Start over if the counter is past the new period, so it does not
+		// have to wrap around
+		if(TCNT1 > OCR1A) {
+			TCNT1 = 0;
+		}
+		cube_update_on_counts_unsafe();
+	}
+}
+
+uint16_t cube_get_layer_period(void) {
+	uint16_t period;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		period = layer_period;
+	}
+	return period;
+}
+
+void cube_get_refresh_latency(uint16_t* min, uint16_t* max, bool reset) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if(latency_min <= latency_max) {
+			*min = cube_timer_us(latency_min);
+			*max = cube_timer_us(latency_max);
+		} else {
+			*min = 0;
+			*max = 0;
+		}
+		if(reset) {
+			latency_min = UINT16_MAX;
+			latency_max = 0;
+		}
+	}
+}
+
+void cube_set_brightness(uint8_t level) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		brightness = level;
+		cube_update_on_counts_unsafe();
+	}
+}
+
+uint8_t cube_get_brightness(void) {
+	return brightness;
+}
+
+void cube_set_power_limit(uint8_t limit) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		power_limit = (limit < 64) ? limit : 64;
+		lit_voxels = 0;
+		counted_voxels = 0;
+		cube_update_on_counts_unsafe();
+	}
+}
+
+uint8_t cube_get_power_limit(void) {
+	return power_limit;
+}
+
+uint16_t cube_get_lit_voxels(void) {
+	uint16_t count;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		count = lit_voxels;
+	}
+	return count;
+}
+
+void cube_hold_frame(uint8_t periods) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		frame_holds[edited_frame] = (periods > 0) ? periods - 1 : 0;
+	}
+}
+
+void cube_set_frame_time(uint16_t time) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		frame_times[edited_frame] = time;
+		frame_timed |= (1U << edited_frame);
+	}
+}
+
+void cube_set_frame_id(uint8_t id) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		frame_ids[edited_frame] = id;
 	}
 }
 
+void cube_set_dedup(bool enabled) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		dedup = enabled;
+	}
+}
+
+void cube_set_latest(bool enabled) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		latest = enabled;
+	}
+}
+
+bool cube_get_latest(void) {
+	return latest;
+}
+
+void cube_flush(void) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint8_t newest_frame = frame_prev(edited_frame);
+		if(newest_frame != current_frame) {
+			// Start displaying the newest frame right away
+			current_frame = newest_frame;
+			current_repeat = 0;
+			current_hold = 0;
+			if(cube_frame_switched_unsafe()) {
+				task_schedule_unsafe();
+			}
+		}
+	}
+}
+
+void cube_get_frame_event(cube_frame_event_t* event) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*event = frame_event;
+	}
+}
+
+bool cube_wait_frame(uint16_t sequence, uint16_t wait_ms) {
+	bool ret = false;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		task_t* task = task_current_unsafe();
+		uint16_t start = timer_get_current_unsafe();
+		// Each frame switch wakes up the task, so wait until the one we need
+		while(frame_event.sequence == sequence && !timer_has_elapsed_unsafe(start, wait_ms)) {
+			task->status |= TASK_WAIT_CUBE;
+			if(wait_ms != TIMER_INFINITE) {
+				task->status |= TASK_WAIT_TIMER;
+				task->wait_until = start + wait_ms;
+			}
+			task_schedule_unsafe();
+		}
+		ret = (frame_event.sequence != sequence);
+	}
+	return ret;
+}
+
+void cube_set_frame_callback(cube_frame_callback_t callback) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		frame_callback = callback;
+	}
+}
+
+uint8_t cube_get_queued_frames(void) {
+	uint8_t queued;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		queued = (edited_frame > current_frame) ? edited_frame - current_frame : frame_count - (current_frame - edited_frame);
+	}
+	return queued - 1;
+}
+
+uint16_t cube_get_latency(void) {
+	uint16_t latency;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// Display time of one frame period in layer periods
+		uint16_t period = (uint16_t)frame_repeat * 8;
+		// Remaining time of the current frame
+		uint32_t total = (uint32_t)(frame_holds[current_frame] - current_hold + 1) * period
+			- (uint16_t)current_repeat * 8 - current_layer;
+		if(!latest) {
+			// Then all queued frames are displayed one after the other
+			for(uint8_t f = frame_next(current_frame); f != edited_frame; f = frame_next(f)) {
+				total += (uint32_t)(frame_holds[f] + 1) * period;
+			}
+		}
+		// Convert to milliseconds in two parts, so it does not overflow
+		total = (total / 1000) * layer_period + (total % 1000) * layer_period / 1000;
+		latency = (total > UINT16_MAX) ? UINT16_MAX : total;
+	}
+	return latency;
+}
+
 uint8_t cube_get_free_frames(void) {
 	uint8_t free_count;
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
 		if(edited_frame < current_frame) {
 			free_count = current_frame - edited_frame;
 		} else {
-			free_count = CUBE_FRAME_BUFFER_COUNT - (edited_frame - current_frame);
+			free_count = frame_count - (edited_frame - current_frame);
 		}
 	}
 	return free_count - 1;
 }
 
 uint8_t* cube_advance_frame(uint16_t wait_ms) {
+	// The edited and the previous frames are not changed by the refresh, so they
+	// can be compared with interrupts enabled
+	bool duplicate = false;
+	if(dedup) {
+		uint8_t* edited = frame_address(edited_frame);
+		duplicate = (memcmp(edited, frame_address(frame_prev(edited_frame)), CUBE_FRAME_SIZE) == 0);
+	}
+
 	uint8_t* ret = NULL;
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint8_t prev_frame = frame_prev(edited_frame);
 		uint8_t next_frame = frame_next(edited_frame);
+		if(duplicate && !frame_is_timed(edited_frame) && frame_holds[prev_frame] < UINT8_MAX - frame_holds[edited_frame]) {
+			// Hold the previous frame for longer instead, and reuse the edited one
+			frame_holds[prev_frame] += frame_holds[edited_frame] + 1;
+			frame_holds[edited_frame] = 0;
+			next_frame = edited_frame;
+		}
+		if(next_frame == current_frame && latest && prev_frame != current_frame) {
+			// The queue is full: the edited frame replaces the newest queued one,
+			// which would be skipped anyway, and it is edited again
+			memcpy(frame_address(prev_frame), frame_address(edited_frame), CUBE_FRAME_SIZE);
+			frame_holds[prev_frame] = frame_holds[edited_frame];
+			frame_times[prev_frame] = frame_times[edited_frame];
+			frame_ids[prev_frame] = frame_ids[edited_frame];
+			frame_timed &= ~(1U << prev_frame);
+			if(frame_is_timed(edited_frame)) {
+				frame_timed |= (1U << prev_frame);
+			}
+			next_frame = edited_frame;
+		}
 
 		// If there's no free frame and we're allowed to then we wait for some
 		// frames to be displayed and become free for editing
@@ -183,6 +729,9 @@ uint8_t* cube_advance_frame(uint16_t wait_ms) {
 		// If there is an available frame, return its address
 		if(next_frame != current_frame) {
 			edited_frame = next_frame;
+			frame_holds[edited_frame] = 0;
+			frame_ids[edited_frame] = 0;
+			frame_timed &= ~(1U << edited_frame);
 			ret = frame_address(edited_frame);
 		}
 	}
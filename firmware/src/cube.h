@@ -2,6 +2,13 @@
  * @file cube.h
  * LED cube output driver and framebuffer module.
  *
+ * The layers are displayed one after the other, each for a layer period, which
+ * is timed by Timer1 independently from the millisecond timer. Eight layer
+ * periods make a layer cycle, and each frame is displayed for a number of
+ * layer cycles, which make up the frame period. When the brightness is reduced,
+ * Timer2 turns off the layer at the end of its on-time through the enable
+ * output, so the on-time does not depend on the interrupt latency.
+ *
  * @copyright (C) 2017 Peter Budai
  */
 
@@ -20,17 +27,95 @@
 #define CUBE_FRAME_SIZE 64
 
 /**
- * How many frames are available in the framebuffer.
+ * Minimum number of frames in the framebuffer.
  * One frame is displayed, but the others are available for pre-rendering.
  */
-#define CUBE_FRAME_BUFFER_COUNT 8
+#define CUBE_FRAME_BUFFER_MIN 2
+
+/// Maximum number of frames in the framebuffer.
+#define CUBE_FRAME_BUFFER_MAX 16
+
+/**
+ * How many times each frame is displayed by default.
+ * A frame takes 8 ms to display once, so this results in a 25 Hz frame rate.
+ */
+#define CUBE_DEFAULT_REPEAT 5
+
+/// Default layer period in microseconds.
+#define CUBE_DEFAULT_LAYER_PERIOD 1000
+/// Shortest layer period in microseconds, the refresh itself takes a good part of it.
+#define CUBE_LAYER_PERIOD_MIN 250
+/// Longest layer period in microseconds, flickering is visible way before it.
+#define CUBE_LAYER_PERIOD_MAX 8000
+
+/// Brightness level when the layers are lit for their whole time slot.
+#define CUBE_BRIGHTNESS_MAX 255
+
+/**
+ * Number of overlay buffers.
+ * Overlays are composited onto the displayed frame when each layer is output,
+ * so they can be updated independently from the frames.
+ */
+#define CUBE_OVERLAY_COUNT 2
+
+/// Ways of compositing an overlay onto the frame below it.
+typedef enum {
+	/// The overlay is not displayed.
+	CUBE_BLEND_OFF,
+	/// Pixels of the overlay are lit.
+	CUBE_BLEND_OR,
+	/// Pixels of the overlay invert the pixels below them.
+	CUBE_BLEND_XOR,
+	/// Only the pixels below the pixels of the overlay are kept.
+	CUBE_BLEND_MASK,
+	/// Pixels below the pixels of the overlay are turned off.
+	CUBE_BLEND_CLEAR
+} cube_blend_t;
+
+/// Frame switch event.
+typedef struct cube_frame_event {
+	/// Sequence number of the displayed frame, it is incremented on each frame switch.
+	uint16_t sequence;
+	/// Timer value when the frame switch happened, see timer_get_current().
+	uint16_t time;
+	/// Identifier of the displayed frame set by its producer, see cube_set_frame_id().
+	uint8_t id;
+} cube_frame_event_t;
+
+/**
+ * Frame switch callback prototype.
+ * It is called from the refresh timer interrupt handler, right after a new
+ * frame was selected for display, before its first layer is displayed in the
+ * next layer period. Keep it short, interrupts are disabled.
+ *
+ * @param event The frame switch event.
+ * @return True if the callback woke up a task, so rescheduling is needed.
+ */
+typedef bool (*cube_frame_callback_t)(const cube_frame_event_t* event);
 
 /**
  * Initializes cube output ports and internal state.
- * This does not turn on the cube and the output refresh timer.
+ * This does not turn on the cube and the output refresh timer, and the
+ * framebuffer has to be set up before turning it on.
  */
 void cube_init(void);
 
+/**
+ * Sets the memory area of the framebuffer, and starts over with an empty frame
+ * displayed, and duplicate frame detection, latest frame wins mode, the
+ * overlays and the canvas turned off. The frames of the
+ * previous framebuffer are discarded, it must not be called while a task is
+ * editing a frame.
+ *
+ * @param buffer Memory area of count * @ref CUBE_FRAME_SIZE bytes.
+ * @param count Number of frames in the framebuffer, at least @ref CUBE_FRAME_BUFFER_MIN,
+ *     and at most @ref CUBE_FRAME_BUFFER_MAX.
+ */
+void cube_set_buffer(uint8_t* buffer, uint8_t count);
+
+/// Returns the number of frames in the framebuffer.
+uint8_t cube_get_buffer_count(void);
+
 /// Turns on the cube by starting the output refresh timer event processing.
 void cube_enable(void);
 
@@ -38,12 +123,214 @@ void cube_enable(void);
 void cube_disable(void);
 
 /**
- * Timer interrupt handler that will periodically refresh cube output
- * to render the frames visually.
- * This will be called by the timer once in every milliseconds, resulting
- * in an approximately 25 Hz frame display rate.
+ * Sets how long each layer is displayed. Together with the frame repeat, it
+ * determines the frame period: 8 * period * repeat microseconds. Shorter
+ * periods reduce flicker, and allow higher frame rates, but cost more CPU time.
+ * While the cube is on, the tasks woken up by the USART and EEPROM interrupts
+ * are switched to at the next refresh, so it is their wake-up latency as well.
+ * It takes effect from the next layer.
+ *
+ * @param period Layer period in microseconds, it is clamped between
+ *     @ref CUBE_LAYER_PERIOD_MIN and @ref CUBE_LAYER_PERIOD_MAX.
+ */
+void cube_set_layer_period(uint16_t period);
+
+/// Returns the layer period in microseconds.
+uint16_t cube_get_layer_period(void);
+
+/**
+ * Sets up an overlay buffer. Overlays are composited in index order onto the
+ * displayed frame: the first one onto the frame, the second one onto the result,
+ * and so on. The buffer is read directly while layers are output, so changes in
+ * it become visible right away, even in the middle of a frame.
+ * Overlays are turned off when the framebuffer is set.
+ *
+ * @param index Overlay index, less than @ref CUBE_OVERLAY_COUNT.
+ * @param buffer Overlay frame of @ref CUBE_FRAME_SIZE bytes, or NULL to turn it off.
+ * @param mode Way of compositing.
+ */
+void cube_set_overlay(uint8_t index, const uint8_t* buffer, cube_blend_t mode);
+
+/**
+ * Displays a window of a virtual canvas instead of the frames. The canvas is
+ * longer than the cube along the rows: it is made of 8 layers of width rows
+ * each, so the byte of a row is at canvas[layer * width + row]. The window
+ * is 8 rows wide, it starts at the scroll offset and wraps around at the end
+ * of the canvas, so scrolling it needs no redrawing at all.
+ * The canvas is read directly while layers are output, and the frame queue
+ * keeps running in the meanwhile, but its frames are not visible.
+ * The canvas is turned off when the framebuffer is set.
+ *
+ * @param buffer Canvas of 8 * width bytes, or NULL to display the frames again.
+ * @param width Number of rows in the canvas, at least 8.
+ */
+void cube_set_canvas(const uint8_t* buffer, uint8_t width);
+
+/**
+ * Sets the row of the canvas where the displayed window starts.
+ *
+ * @param offset First displayed row, it wraps around at the width of the canvas.
+ */
+void cube_scroll(uint8_t offset);
+
+/**
+ * Sets how many times each frame is displayed before switching to the next one,
+ * which determines the frame rate. It takes effect from the next frame.
+ *
+ * @param repeat Number of displays per frame, at least 1.
+ */
+void cube_set_repeat(uint8_t repeat);
+
+/// Returns how many times each frame is displayed.
+uint8_t cube_get_repeat(void);
+
+/**
+ * Returns how late the refreshes started after the refresh timer fired, as
+ * they may be delayed by other interrupt handlers. The spread between the
+ * earliest and the latest start is the jitter of the layer periods.
+ * The next layer is prepared in advance, so the layers are displayed at a
+ * fixed time after the refresh starts.
+ *
+ * @param min Set to the earliest start in microseconds, 0 if there was no refresh.
+ * @param max Set to the latest start in microseconds, 0 if there was no refresh.
+ * @param reset True to start measuring over after reading.
+ */
+void cube_get_refresh_latency(uint16_t* min, uint16_t* max, bool reset);
+
+/**
+ * Sets the brightness by lighting each layer for only a part of its time slot.
+ * This lowers the current draw and the heat as well. It takes effect from the
+ * next layer.
+ *
+ * @param level Portion of the time slot, from 0 (off) to
+ *     @ref CUBE_BRIGHTNESS_MAX (the whole slot).
+ */
+void cube_set_brightness(uint8_t level);
+
+/// Returns the brightness level.
+uint8_t cube_get_brightness(void);
+
+/**
+ * Sets the power limit. When a frame has more lit voxels than the limit allows,
+ * the cube is dimmed in proportion, so the average current draw stays below
+ * the limit set at full brightness. The voxels are counted as the layers are
+ * displayed, and the dimming applies from the next layer cycle.
+ *
+ * @param limit Maximum average number of lit voxels per layer at full
+ *     brightness, at most 64, or 0 to turn the limit off.
+ */
+void cube_set_power_limit(uint8_t limit);
+
+/// Returns the power limit, 0 if it is off.
+uint8_t cube_get_power_limit(void);
+
+/**
+ * Returns the number of lit voxels in the last layer cycle, overlays included. Only counted while the power limit is on, otherwise it is 0.
+ */
+uint16_t cube_get_lit_voxels(void);
+
+/**
+ * Sets how many frame periods the currently edited frame is displayed for,
+ * so a still scene can be held for a long time using a single frame.
+ * It is reset to 1 for each new frame returned by cube_advance_frame().
+ *
+ * @param periods Number of frame periods, at least 1.
+ */
+void cube_hold_frame(uint8_t periods);
+
+/**
+ * Sets the presentation time of the currently edited frame. When the frame is
+ * queued, it is displayed at the first layer cycle boundary at or after
+ * the given time, instead of after the repeats and the hold of the previous
+ * frame. Frames without a time are displayed as usual.
+ * It is reset for each new frame returned by cube_advance_frame().
+ *
+ * @param time Timer value to display the frame at, see timer_get_current().
+ *     It should be less than 32 seconds ahead, otherwise it is taken as late.
+ */
+void cube_set_frame_time(uint16_t time);
+
+/**
+ * Tags the currently edited frame with an identifier, which is reported in the
+ * frame switch event when it gets displayed, so the producer can tell which
+ * one of its frames is displayed, and when. Frames that are skipped or merged
+ * as duplicates are never displayed on their own, so they are not reported.
+ * It is reset to 0 for each new frame returned by cube_advance_frame().
+ *
+ * @param id Frame identifier, eg. a wrapping counter of the producer.
+ */
+void cube_set_frame_id(uint8_t id);
+
+/**
+ * Turns duplicate frame detection on or off. When it is on, cube_advance_frame()
+ * compares the edited frame to the previous one, and if they are the same, it
+ * holds the previous frame for one more frame period instead of queueing a new
+ * one, and returns the same frame for editing again without waiting.
+ * Timed frames are never merged.
+ * Comparing frames takes time, so it is off by default.
+ *
+ * @param enabled True to turn detection on.
+ */
+void cube_set_dedup(bool enabled);
+
+/**
+ * Turns the "latest frame wins" mode on or off. In this mode, when the current
+ * frame has been displayed, the newest queued frame is displayed next, and the
+ * older ones are dropped. It trades smoothness for latency, eg. for interactive
+ * content. When the queue is full, cube_advance_frame() does not wait either:
+ * the edited frame replaces the newest queued one, and the same frame is
+ * returned for editing again, with its contents kept.
+ * It is off by default, when every frame is displayed in order.
+ *
+ * @param enabled True to turn the mode on.
+ */
+void cube_set_latest(bool enabled);
+
+/// Returns true if the "latest frame wins" mode is on.
+bool cube_get_latest(void);
+
+/**
+ * Drops all queued frames but the newest one, and starts displaying that
+ * right away. The edited frame is not affected.
+ */
+void cube_flush(void);
+
+/**
+ * Returns the last frame switch event.
+ *
+ * @param event Set to the sequence number and the time of the last frame switch.
+ */
+void cube_get_frame_event(cube_frame_event_t* event);
+
+/**
+ * Waits for the next frame switch.
+ *
+ * @param sequence Sequence number of the last frame switch already seen by
+ *     the caller, see cube_get_frame_event().
+ * @param wait_ms Maximum number of milliseconds to wait for a frame switch.
+ *     Value of 0 will make this function non-blocking.
+ *     Value of @ref TIMER_INFINITE will make the the function block indefinitely
+ *     until a frame switch happens.
+ * @return True if a frame switch happened after the given one.
+ */
+bool cube_wait_frame(uint16_t sequence, uint16_t wait_ms);
+
+/**
+ * Sets the callback that is notified about each frame switch.
+ *
+ * @param callback The callback, or NULL to turn off notifications.
+ */
+void cube_set_frame_callback(cube_frame_callback_t callback);
+
+/// Returns how many frames are queued for display after the current one.
+uint8_t cube_get_queued_frames(void);
+
+/**
+ * Returns the display latency: how many milliseconds it takes until a frame
+ * queued now gets displayed, if the refresh is not delayed. Presentation
+ * times of timed frames are not taken into account.
  */
-bool cube_refresh(void);
+uint16_t cube_get_latency(void);
 
 /**
  * Returns how many frames are available in the framebuffer for editing.
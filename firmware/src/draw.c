@@ -52,4 +52,28 @@ void set_plane(uint8_t* frame, plane_t plane, uint8_t n, const uint8_t* value) {
 	}
 }
 
+void draw_line(uint8_t* frame, uint8_t row0, uint8_t column0, uint8_t row1, uint8_t column1, uint8_t layer) {
+	// Bresenham's algorithm, stepping along both axes by the error term
+	int8_t drow = (row1 > row0) ? row1 - row0 : row0 - row1;
+	int8_t dcolumn = (column1 > column0) ? column1 - column0 : column0 - column1;
+	int8_t srow = (row1 > row0) ? 1 : -1;
+	int8_t scolumn = (column1 > column0) ? 1 : -1;
+	int8_t error = dcolumn - drow;
+	for(;;) {
+		draw_pixel(frame, row0, column0, layer);
+		if(row0 == row1 && column0 == column1) {
+			break;
+		}
+		int8_t error2 = 2 * error;
+		if(error2 > -drow) {
+			error -= drow;
+			column0 += scolumn;
+		}
+		if(error2 < dcolumn) {
+			error += dcolumn;
+			row0 += srow;
+		}
+	}
+}
+
 #endif // NO_CUBE
@@ -51,6 +51,18 @@ void set_pixel(uint8_t* frame, uint8_t row, uint8_t column, uint8_t layer, bool
  */
 void set_plane(uint8_t* frame, plane_t plane, uint8_t n, const uint8_t* value);
 
+/**
+ * Lights up a straight line of pixels within a layer, including both ends.
+ *
+ * @param frame Pointer to the edited frame.
+ * @param row0 Row coordinate of the start point.
+ * @param column0 Column coordinate of the start point.
+ * @param row1 Row coordinate of the end point.
+ * @param column1 Column coordinate of the end point.
+ * @param layer Layer to draw in.
+ */
+void draw_line(uint8_t* frame, uint8_t row0, uint8_t column0, uint8_t row1, uint8_t column1, uint8_t layer);
+
 #endif // NO_CUBE
 
 #endif // _DRAW_H_
@@ -0,0 +1,128 @@
+#include "eeprom.h"
+
+#ifndef NO_EEPROM
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "task.h"
+#include "timer.h"
+
+// Maximum number of unchanged bytes skipped by one interrupt
+#define EEPROM_SKIP_MAX 8
+
+/// A queued write, it is advanced in place as its bytes are programmed.
+typedef struct eeprom_request {
+	uint16_t address;
+	const uint8_t* src;
+	uint16_t count;
+} eeprom_request_t;
+
+eeprom_request_t eeprom_queue[EEPROM_QUEUE_SIZE];
+// Index of the write in progress
+uint8_t eeprom_queue_start;
+// Number of queued writes, including the one in progress
+volatile uint8_t eeprom_queue_count;
+
+// EEPROM ready interrupt handler
+// It is called repeatedly while it is enabled and no byte is being programmed.
+ISR(EE_READY_vect) {
+	eeprom_request_t* request = &eeprom_queue[eeprom_queue_start];
+	if(request->count == 0) {
+		// The last byte of the write is programmed, remove it from the queue
+		eeprom_queue_start = (eeprom_queue_start + 1) % EEPROM_QUEUE_SIZE;
+		if(--eeprom_queue_count == 0) {
+			EECR &= ~(1 << EERIE);
+		}
+		// Wake up the tasks waiting for room in the queue, or the completion
+		for(uint8_t i = 0; i < TASK_COUNT; ++i) {
+			if(tasks[i].status & TASK_WAIT_EEPROM) {
+				tasks[i].status &= ~TASK_WAITING;
+			}
+		}
+		task_wake_unsafe();
+		return;
+	}
+
+	for(uint8_t i = 0; i < EEPROM_SKIP_MAX && request->count > 0; ++i) {
+		uint8_t data = *request->src++;
+		EEAR = request->address++;
+		request->count--;
+		EECR |= (1 << EERE);
+		if(EEDR != data) {
+			// Erase and write the byte, it completes with the next interrupt
+			EEDR = data;
+			EECR |= (1 << EEMPE);
+			EECR |= (1 << EEPE);
+			break;
+		}
+	}
+}
+
+// Blocks the current task until the queue changes or wait_ms elapses
+static void eeprom_block_unsafe(uint16_t start, uint16_t wait_ms) {
+	task_t* task = task_current_unsafe();
+	task->status |= TASK_WAIT_EEPROM;
+	if(wait_ms != TIMER_INFINITE) {
+		// Set up a timeout as well
+		task->status |= TASK_WAIT_TIMER;
+		task->wait_until = start + wait_ms;
+	}
+	task_schedule_unsafe();
+}
+
+bool eeprom_write(uint16_t address, const uint8_t* src, uint16_t count, uint16_t wait_ms) {
+	if(count == 0) {
+		return true;
+	}
+	bool ret = false;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint16_t start = timer_get_current_unsafe();
+		while(eeprom_queue_count == EEPROM_QUEUE_SIZE && !timer_has_elapsed_unsafe(start, wait_ms)) {
+			eeprom_block_unsafe(start, wait_ms);
+		}
+		if(eeprom_queue_count < EEPROM_QUEUE_SIZE) {
+			eeprom_request_t* request = &eeprom_queue[(eeprom_queue_start + eeprom_queue_count) % EEPROM_QUEUE_SIZE];
+			request->address = address;
+			request->src = src;
+			request->count = count;
+			eeprom_queue_count++;
+			EECR |= (1 << EERIE);
+			ret = true;
+		}
+	}
+	return ret;
+}
+
+bool eeprom_wait(uint16_t wait_ms) {
+	bool ret;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint16_t start = timer_get_current_unsafe();
+		while(eeprom_queue_count > 0 && !timer_has_elapsed_unsafe(start, wait_ms)) {
+			eeprom_block_unsafe(start, wait_ms);
+		}
+		ret = (eeprom_queue_count == 0);
+	}
+	return ret;
+}
+
+void eeprom_read(uint8_t* dest, uint16_t address, uint16_t count) {
+	while(count > 0) {
+		// The writer must not change the address between setting it and reading
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			if(!(EECR & (1 << EEPE))) {
+				EEAR = address++;
+				EECR |= (1 << EERE);
+				*dest++ = EEDR;
+				count--;
+			}
+		}
+	}
+}
+
+bool eeprom_is_busy_unsafe(void) {
+	return eeprom_queue_count > 0 || (EECR & (1 << EEPE));
+}
+
+#endif // NO_EEPROM
@@ -0,0 +1,78 @@
+/**
+ * @file eeprom.h
+ * Non-blocking EEPROM writer.
+ *
+ * Programming an EEPROM byte takes 3.4 ms, so instead of waiting for each
+ * byte like the avr/eeprom.h functions do, writes are queued, and their bytes
+ * are programmed one after the other from the EEPROM ready interrupt.
+ * The writing task can keep running, or it can wait for the writes to complete
+ * like it waits for any other peripherial, so the other tasks keep running.
+ * Bytes that already hold the data are not programmed again.
+ *
+ * While writes are queued, the EEPROM must be read with eeprom_read() only,
+ * as the avr/eeprom.h functions could be interrupted by the writer.
+ *
+ * @copyright (C) 2018 Peter Budai
+ */
+
+#ifndef _EEPROM_H_
+#define _EEPROM_H_
+
+#ifndef NO_EEPROM
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Number of writes that can be queued at the same time.
+#define EEPROM_QUEUE_SIZE 4
+
+/**
+ * Queues a write of a buffer to the EEPROM.
+ * The buffer is not copied, it must not be modified or freed until the write
+ * is complete, see eeprom_wait().
+ *
+ * @param address EEPROM address to write to.
+ * @param src Data to write.
+ * @param count Number of bytes to write.
+ * @param wait_ms Maximum number of milliseconds to wait for room in the queue.
+ *     Value of 0 will make this function non-blocking.
+ *     Value of @ref TIMER_INFINITE will make the the function block indefinitely
+ *     until the write can be queued.
+ * @return True if the write was queued.
+ *     False if the queue was full until wait_ms elapsed.
+ */
+bool eeprom_write(uint16_t address, const uint8_t* src, uint16_t count, uint16_t wait_ms);
+
+/**
+ * Returns or waits for the completion of all queued writes.
+ *
+ * @param wait_ms Maximum number of milliseconds to wait for the writes.
+ *     Value of 0 will make this function non-blocking.
+ *     Value of @ref TIMER_INFINITE will make the the function block indefinitely
+ *     until the writes are complete.
+ * @return True if there are no queued writes, so their buffers are free to reuse.
+ *     False if writes were still queued when wait_ms elapsed.
+ */
+bool eeprom_wait(uint16_t wait_ms);
+
+/**
+ * Reads a block of the EEPROM.
+ * If a byte is being programmed, it waits until that completes.
+ *
+ * @param dest Buffer to read into.
+ * @param address EEPROM address to read from.
+ * @param count Number of bytes to read.
+ */
+void eeprom_read(uint8_t* dest, uint16_t address, uint16_t count);
+
+/**
+ * Tells whether there are queued writes, or a byte is being programmed.
+ * Interrupts must be disabled when calling it.
+ *
+ * @return True if the EEPROM ready interrupt is still needed.
+ */
+bool eeprom_is_busy_unsafe(void);
+
+#endif // NO_EEPROM
+
+#endif // _EEPROM_H_
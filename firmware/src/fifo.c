@@ -2,10 +2,13 @@
 
 #ifndef NO_USART
 
+#include <string.h>
+
 void fifo_init(fifo_t* fifo, uint8_t* buffer, size_t capacity) {
     fifo->buffer = buffer;
-    fifo->capacity = capacity;
+    fifo->mask = capacity - 1;
     fifo_clear(fifo);
+    fifo->peak = 0;
 }
 
 void fifo_clear(fifo_t* fifo) {
@@ -15,39 +18,60 @@ void fifo_clear(fifo_t* fifo) {
     fifo->count = 0;
 }
 
-static size_t fifo_normalize(fifo_t* fifo, size_t index) {
-    return (index < fifo->capacity) ? index : (index - fifo->capacity);
-}
+#define fifo_wrap(fifo, index) ((index) & (fifo)->mask)
+#define fifo_end(fifo) fifo_wrap(fifo, (fifo)->start + (fifo)->size)
+#define fifo_update_peak(fifo) do { \
+    if((fifo)->size > (fifo)->peak) (fifo)->peak = (fifo)->size; \
+} while(0)
 
 bool fifo_begin_push(fifo_t* fifo, size_t count) {
     if(fifo_available(fifo) < count) {
         return false;
     }
     fifo->count = 0;
-    fifo->current = fifo_normalize(fifo, fifo->start + fifo->size);
+    fifo->current = fifo_end(fifo);
     return true;
 }
 
-void fifo_push(fifo_t* fifo, uint8_t data) {
-    fifo->buffer[fifo->current] = data;
-    fifo->current = fifo_normalize(fifo, fifo->current + 1);
-    fifo->count++;
+bool fifo_begin_push_contiguous(fifo_t* fifo, size_t count, uint8_t pad) {
+    fifo_index_t end = fifo_end(fifo);
+    size_t tail = fifo_capacity(fifo) - end;
+    size_t skip = (tail < count) ? tail : 0;
+    if(fifo_available(fifo) < skip + count) {
+        return false;
+    }
+    fifo->count = 0;
+    fifo->current = end;
+    if(skip > 0) {
+        // Mark and skip the remaining space at the end of the buffer
+        fifo->buffer[end] = pad;
+        fifo->current = 0;
+        fifo->count = skip;
+    }
+    return true;
 }
 
 void fifo_commit_push(fifo_t* fifo) {
     fifo->size += fifo->count;
     fifo->count = 0;
+    fifo_update_peak(fifo);
 }
 
 bool fifo_push_bytes(fifo_t* fifo, const uint8_t* src, size_t count) {
     if(fifo_available(fifo) < count) {
         return false;
     }
-    size_t dest = fifo_normalize(fifo, fifo->start + fifo->size);
-    for(size_t i = 0; i < count; ++i) {
-        fifo->buffer[fifo_normalize(fifo, dest + i)] = src[i];
+    // Copy up to the end of the buffer, then the rest to its beginning
+    fifo_index_t dest = fifo_end(fifo);
+    size_t first = fifo_capacity(fifo) - dest;
+    if(first >= count) {
+        memcpy(fifo->buffer + dest, src, count);
+    } else {
+        memcpy(fifo->buffer + dest, src, first);
+        memcpy(fifo->buffer, src + first, count - first);
     }
     fifo->size += count;
+    fifo_update_peak(fifo);
     return true;
 }
 
@@ -60,19 +84,8 @@ bool fifo_begin_pop(fifo_t* fifo, size_t count) {
     return true;
 }
 
-uint8_t fifo_peek(fifo_t* fifo) {
-    return fifo->buffer[fifo->current];
-}
-
-uint8_t fifo_pop(fifo_t* fifo) {
-    uint8_t data = fifo->buffer[fifo->current];
-    fifo->current = fifo_normalize(fifo, fifo->current + 1);
-    fifo->count++;
-    return data;
-}
-
 void fifo_commit_pop(fifo_t* fifo) {
-    fifo->start = fifo_normalize(fifo, fifo->start + fifo->count);
+    fifo->start = fifo_wrap(fifo, fifo->start + fifo->count);
     fifo->size -= fifo->count;
     fifo->count = 0;
 }
@@ -81,13 +94,39 @@ bool fifo_pop_bytes(fifo_t* fifo, uint8_t* dest, size_t count) {
     if(fifo_size(fifo) < count) {
         return false;
     }
-    size_t src = fifo->start;
-    for(size_t i = 0; i < count; ++i) {
-        dest[i] = fifo->buffer[fifo_normalize(fifo, src + i)];
+    // Copy up to the end of the buffer, then the rest from its beginning
+    size_t first = fifo_capacity(fifo) - fifo->start;
+    if(first >= count) {
+        memcpy(dest, fifo->buffer + fifo->start, count);
+    } else {
+        memcpy(dest, fifo->buffer + fifo->start, first);
+        memcpy(dest + first, fifo->buffer, count - first);
     }
-    fifo->start = fifo_normalize(fifo, fifo->start + count);
-    fifo->size -= count;
+    fifo_skip(fifo, count);
     return true;
 }
 
+size_t fifo_peek_span(fifo_t* fifo, uint8_t** data) {
+    size_t count = fifo_capacity(fifo) - fifo->start;
+    *data = fifo->buffer + fifo->start;
+    return (count < fifo->size) ? count : fifo->size;
+}
+
+void fifo_skip(fifo_t* fifo, size_t count) {
+    fifo->start = fifo_wrap(fifo, fifo->start + count);
+    fifo->size -= count;
+}
+
+size_t fifo_reserve_span(fifo_t* fifo, uint8_t** data) {
+    fifo_index_t end = fifo_end(fifo);
+    size_t count = fifo_capacity(fifo) - end;
+    *data = fifo->buffer + end;
+    return (count < fifo_available(fifo)) ? count : fifo_available(fifo);
+}
+
+void fifo_append(fifo_t* fifo, size_t count) {
+    fifo->size += count;
+    fifo_update_peak(fifo);
+}
+
 #endif // NO_USART
@@ -1,6 +1,8 @@
 /**
  * @file fifo.h
  * Simple byte queue for USART communication.
+ * The capacity of the queue must be a power of two, so wrapping indices around
+ * is a single masking operation instead of a compare and subtract.
  *
  * @copyright (C) 2018 Peter Budai
  */
@@ -14,44 +16,142 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/**
+ * Index type of the FIFO buffer.
+ * 8-bit indices would be faster, but the application receive buffer is larger
+ * than 256 bytes, so all FIFOs use 16-bit indices.
+ */
+typedef uint16_t fifo_index_t;
+
 /// Circular-buffer FIFO structure.
 typedef struct fifo {
     /// Pointer to the whole buffer data area.
     uint8_t* buffer;
-    /// Capacity of the whole buffer.
-    size_t capacity;
+    /// Capacity of the whole buffer minus one, used for wrapping indices around.
+    fifo_index_t mask;
     // Index where the first unread data byte starts.
-    size_t start;
+    fifo_index_t start;
     /// Number of bytes currently in the buffer.
-    size_t size;
+    fifo_index_t size;
     /// Index of the next transfer operation (pop or push).
-    size_t current;
+    fifo_index_t current;
     /// Number of bytes affected by the current transfer operation (pop or push).
-    size_t count;
+    fifo_index_t count;
+    /// Highest number of bytes that has ever been in the buffer (high-water mark).
+    fifo_index_t peak;
 } fifo_t;
 
+#define fifo_capacity(fifo) ((size_t)(fifo)->mask + 1)
 #define fifo_size(fifo) ((fifo)->size)
-#define fifo_available(fifo) ((fifo)->capacity - (fifo)->size)
+#define fifo_available(fifo) (fifo_capacity(fifo) - (fifo)->size)
+#define fifo_peak(fifo) ((fifo)->peak)
+#define fifo_reset_peak(fifo) ((fifo)->peak = (fifo)->size)
 
-/// Initialize an empty FIFO using the underlying buffer.
+/**
+ * Initialize an empty FIFO using the underlying buffer.
+ * @param capacity Size of the buffer, it must be a power of two.
+ */
 void fifo_init(fifo_t* fifo, uint8_t* buffer, size_t capacity);
 
 /// Clears the FIFO.
 void fifo_clear(fifo_t* fifo);
 
+/**
+ * @name Byte-by-byte transfer operations.
+ * A transfer begins with reserving space or data, then it goes byte by byte,
+ * and the transferred bytes become visible only when the transfer is committed.
+ */
+/// @{
+
 bool fifo_begin_push(fifo_t* fifo, size_t count);
-void fifo_push(fifo_t* fifo, uint8_t data);
 void fifo_commit_push(fifo_t* fifo);
 
-bool fifo_push_bytes(fifo_t* fifo, const uint8_t* src, size_t count);
+/**
+ * Begins a push transfer that will be stored contiguously in the buffer.
+ * If the bytes would wrap around, the free space at the end of the buffer is
+ * skipped: its first byte is set to pad, and the transfer continues at the
+ * beginning of the buffer. The skipped space is committed with the transfer.
+ * @return True if there was enough free space, including the skipped part.
+ */
+bool fifo_begin_push_contiguous(fifo_t* fifo, size_t count, uint8_t pad);
+
+static inline void fifo_push(fifo_t* fifo, uint8_t data) {
+    fifo->buffer[fifo->current] = data;
+    fifo->current = (fifo->current + 1) & fifo->mask;
+    fifo->count++;
+}
 
 bool fifo_begin_pop(fifo_t* fifo, size_t count);
-uint8_t fifo_peek(fifo_t* fifo);
-uint8_t fifo_pop(fifo_t* fifo);
 void fifo_commit_pop(fifo_t* fifo);
 
+static inline uint8_t fifo_peek(fifo_t* fifo) {
+    return fifo->buffer[fifo->current];
+}
+
+static inline uint8_t fifo_pop(fifo_t* fifo) {
+    uint8_t data = fifo->buffer[fifo->current];
+    fifo->current = (fifo->current + 1) & fifo->mask;
+    fifo->count++;
+    return data;
+}
+
+/// Returns the byte at the given offset from the beginning, without removing it.
+static inline uint8_t fifo_peek_at(fifo_t* fifo, size_t offset) {
+    return fifo->buffer[(fifo->start + offset) & fifo->mask];
+}
+
+/// @}
+
+/**
+ * @name Bulk transfer operations.
+ * These copy at most two contiguous blocks of memory.
+ */
+/// @{
+
+bool fifo_push_bytes(fifo_t* fifo, const uint8_t* src, size_t count);
 bool fifo_pop_bytes(fifo_t* fifo, uint8_t* dest, size_t count);
 
+/// @}
+
+/**
+ * @name In-place transfer operations.
+ * These give access to the largest contiguous block of data or free space
+ * in the buffer, so it can be processed without copying.
+ */
+/// @{
+
+/**
+ * Returns the contiguous block of data at the beginning of the FIFO.
+ * @param data Set to the address of the first unread byte.
+ * @return Number of bytes available at that address, 0 if the FIFO is empty.
+ *     It may be less than the size of the FIFO if the data wraps around.
+ */
+size_t fifo_peek_span(fifo_t* fifo, uint8_t** data);
+
+/**
+ * Removes bytes from the beginning of the FIFO, usually after they were
+ * processed via fifo_peek_span().
+ * @param count Number of bytes to remove, at most the size of the FIFO.
+ */
+void fifo_skip(fifo_t* fifo, size_t count);
+
+/**
+ * Returns the contiguous block of free space at the end of the FIFO.
+ * @param data Set to the address of the first free byte.
+ * @return Number of bytes available at that address, 0 if the FIFO is full.
+ *     It may be less than the free space of the FIFO if it wraps around.
+ */
+size_t fifo_reserve_span(fifo_t* fifo, uint8_t** data);
+
+/**
+ * Appends bytes to the end of the FIFO, usually after they were written
+ * via fifo_reserve_span().
+ * @param count Number of bytes to append, at most the free space of the FIFO.
+ */
+void fifo_append(fifo_t* fifo, size_t count);
+
+/// @}
+
 #endif // NO_USART
 
 #endif // _FIFO_H_
@@ -0,0 +1,34 @@
+#include "fixmath.h"
+
+#include <avr/pgmspace.h>
+
+// First quarter of the sine wave, including both ends
+static const uint8_t fix_sin_table[FIX_TURN / 4 + 1] PROGMEM = {
+	0, 3, 6, 9, 12, 16, 19, 22, 25, 28, 31, 34, 37, 40, 43, 46,
+	49, 51, 54, 57, 60, 63, 65, 68, 71, 73, 76, 78, 81, 83, 85, 88,
+	90, 92, 94, 96, 98, 100, 102, 104, 106, 107, 109, 111, 112, 113, 115, 116,
+	117, 118, 120, 121, 122, 122, 123, 124, 125, 125, 126, 126, 126, 127, 127, 127,
+	127
+};
+
+int8_t fix_sin(uint8_t angle) {
+	// Mirror the other quarters onto the first one
+	uint8_t index = angle & (FIX_TURN / 4 - 1);
+	if(angle & (FIX_TURN / 4)) {
+		index = FIX_TURN / 4 - index;
+	}
+	int8_t value = pgm_read_byte(&fix_sin_table[index]);
+	return (angle & (FIX_TURN / 2)) ? -value : value;
+}
+
+uint8_t fix_sqrt(uint16_t value) {
+	// Find the result bit by bit, from the highest one
+	uint8_t root = 0;
+	for(uint8_t bit = 0x80; bit > 0; bit >>= 1) {
+		uint8_t trial = root | bit;
+		if((uint16_t)trial * trial <= value) {
+			root = trial;
+		}
+	}
+	return root;
+}
@@ -0,0 +1,58 @@
+/**
+ * @file fixmath.h
+ * Integer-only math for effects: 8-bit angles, and sine and cosine scaled to
+ * signed 8-bit fixed-point values, looked up from a table in program memory.
+ *
+ * An angle of 256 units is a full turn, so angles wrap around for free.
+ * Fixed-point values have 7 fractional bits: 127 stands for (almost) 1.0.
+ *
+ * @copyright (C) 2018 Peter Budai
+ */
+
+#ifndef _FIXMATH_H_
+#define _FIXMATH_H_
+
+#include <stdint.h>
+
+/// Angle units in a full turn.
+#define FIX_TURN 256
+/// Fixed-point value of 1.0, rounded down to fit into 8 bits.
+#define FIX_ONE 127
+
+/**
+ * Returns the sine of an angle.
+ *
+ * @param angle Angle in 1/256 turns.
+ * @return Sine scaled to -127..127.
+ */
+int8_t fix_sin(uint8_t angle);
+
+/**
+ * Returns the cosine of an angle.
+ *
+ * @param angle Angle in 1/256 turns.
+ * @return Cosine scaled to -127..127.
+ */
+static inline int8_t fix_cos(uint8_t angle) {
+	return fix_sin(angle + FIX_TURN / 4);
+}
+
+/**
+ * Scales a value by a fixed-point factor.
+ *
+ * @param value Any 16-bit value.
+ * @param factor Fixed-point factor, eg. the result of fix_sin().
+ * @return value * factor / 128, rounded towards negative infinity.
+ */
+static inline int16_t fix_scale(int16_t value, int8_t factor) {
+	return (int16_t)(((int32_t)value * factor) >> 7);
+}
+
+/**
+ * Returns the integer square root of a value.
+ *
+ * @return The largest integer whose square is not greater than the value.
+ */
+uint8_t fix_sqrt(uint16_t value);
+
+#endif // _FIXMATH_H_
@@ -0,0 +1,43 @@
+#include "flash.h"
+
+#ifndef NO_FLASH
+
+#include <avr/boot.h>
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+
+#define FLASH_STRINGIFY(x) #x
+#define FLASH_STRING(x) FLASH_STRINGIFY(x)
+
+// Export the start of the store for the link time check
+__asm__(".global __flash_store_start\n\t.set __flash_store_start, " FLASH_STRING(FLASH_STORE_START));
+
+// Erases and writes a page, it must run from the boot section
+// Nothing in the application section may be called from here, not even the
+// interrupt handlers, so it only uses inlined operations.
+static void BOOTLOADER_SECTION __attribute__((noinline)) flash_program_page(uint16_t address, const uint8_t* data) {
+	uint8_t sreg = SREG;
+	cli();
+	// Flash cannot be written while an EEPROM write is in progress
+	eeprom_busy_wait();
+	boot_page_erase(address);
+	boot_spm_busy_wait();
+	for(uint8_t i = 0; i < FLASH_PAGE_SIZE; i += 2) {
+		boot_page_fill(address + i, data[i] | ((uint16_t)data[i + 1] << 8));
+	}
+	boot_page_write(address);
+	boot_spm_busy_wait();
+	// Make the application section readable again, before returning into it
+	boot_rww_enable();
+	SREG = sreg;
+}
+
+bool flash_write_page(uint8_t page, const uint8_t* data) {
+	if(page >= FLASH_STORE_PAGES) {
+		return false;
+	}
+	flash_program_page(FLASH_STORE_START + (uint16_t)page * FLASH_PAGE_SIZE, data);
+	return true;
+}
+
+#endif // NO_FLASH
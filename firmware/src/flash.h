@@ -0,0 +1,57 @@
+/**
+ * @file flash.h
+ * Self-programming of the spare program flash, used as data storage.
+ *
+ * The storage area is at the end of the application flash section, right
+ * below the largest boot section, so it can be rewritten whatever the boot
+ * size fuses are. The program must fit below @ref FLASH_STORE_START, this is
+ * checked at link time.
+ *
+ * Flash can only be written by code in the boot section, so the page writer
+ * is placed there, see the boot section start and end in the Makefile. It is
+ * part of the hex file, and its size is checked at link time.
+ * Interrupt vectors and handlers are in the application section, which cannot
+ * be read while a page is erased or written, so interrupts are disabled
+ * during the write: it takes about 9 ms, the timer loses as many ticks, and
+ * bytes arriving on the USART meanwhile are lost.
+ *
+ * @copyright (C) 2018 Peter Budai
+ */
+
+#ifndef _FLASH_H_
+#define _FLASH_H_
+
+#ifndef NO_FLASH
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+/// Size of a flash page, the unit of writes.
+#define FLASH_PAGE_SIZE SPM_PAGESIZE
+/// Start address of the storage area.
+#define FLASH_STORE_START 0x5000
+/// Size of the storage area, up to the largest boot section.
+#define FLASH_STORE_SIZE 0x2000
+/// Number of pages in the storage area.
+#define FLASH_STORE_PAGES (FLASH_STORE_SIZE / FLASH_PAGE_SIZE)
+
+/**
+ * Writes a whole page of the storage area.
+ * It blocks with interrupts disabled until the page is written.
+ *
+ * @param page Page index in the storage area.
+ * @param data @ref FLASH_PAGE_SIZE bytes to write.
+ * @return False if the page is outside the storage area.
+ */
+bool flash_write_page(uint8_t page, const uint8_t* data);
+
+/// Reads a byte of the storage area.
+static inline uint8_t flash_read_byte(uint16_t offset) {
+	return pgm_read_byte(FLASH_STORE_START + offset);
+}
+
+#endif // NO_FLASH
+
+#endif // _FLASH_H_
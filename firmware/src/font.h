@@ -18,6 +18,12 @@
  */
 #define FONT_CHAR_COUNT 128
 
+/**
+ * First character stored in the font.
+ * Control characters before it are blank, so they are not stored.
+ */
+#define FONT_FIRST_CHAR 32
+
 /**
  * How many bytes a single character occupies.
  * 8x8 bitmap font requires 8 bytes per character.
@@ -21,6 +21,8 @@ int main(void)
 	// 0x???    CPU_STACK_END - 1    |
 	// ...                           | global variables
 	// 0x100    RAMSTART             |
+	//
+	// The app stack is at least APP_STACK_MIN bytes, it is checked at link time.
 
 	// Init multitasking
 	system_task_init();
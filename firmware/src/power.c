@@ -0,0 +1,156 @@
+#include "power.h"
+
+#ifndef NO_POWER
+
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+
+#include "eeprom.h"
+#include "task.h"
+#include "timer.h"
+#include "usart.h"
+
+// Peripherials that are never used: the cube is driven by port writes timed by
+// Timer1, and by Timer2 that ends the on-time of the layers
+#define POWER_UNUSED ((1 << PRTWI) | (1 << PRSPI) | (1 << PRADC))
+
+// Possible power states
+typedef enum {
+	// Not in standby
+	POWER_ACTIVE,
+	// Standby in power-down mode, the watchdog keeps the time
+	POWER_ASLEEP,
+	// Standby in idle mode for a while after traffic
+	POWER_AWAKE
+} power_state_t;
+
+power_state_t power_state;
+// Number of watchdog periods left to stay awake for
+uint8_t power_awake_ticks;
+// True if there was traffic in the current watchdog period
+bool power_activity;
+
+void power_init(void) {
+	// Turn off the analog comparator, then clock gate the rest
+	ACSR = (1 << ACD);
+	PRR |= POWER_UNUSED;
+}
+
+// Watches for the next start bit on the receive pin
+static void power_watch_unsafe(void) {
+#if !defined(NO_USART) && !defined(NO_USART_RECV)
+	PCIFR = (1 << PCIF2);
+	PCMSK2 |= (1 << PCINT16);
+#endif
+}
+
+// Goes to power-down mode when the tasks are idle
+static void power_sleep_unsafe(void) {
+	timer_suspend_unsafe();
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	power_watch_unsafe();
+	power_state = POWER_ASLEEP;
+}
+
+// Stays in idle mode while there is traffic
+static void power_wake_unsafe(void) {
+	timer_resume_unsafe();
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	power_awake_ticks = POWER_AWAKE_TICKS;
+	power_activity = false;
+	power_state = POWER_AWAKE;
+}
+
+#if !defined(NO_USART) && !defined(NO_USART_RECV)
+/// Receive pin change interrupt handler, only enabled in standby.
+ISR(PCINT2_vect) {
+	// One edge per watchdog period is enough, the rest would only cost wake-ups
+	PCMSK2 &= ~(1 << PCINT16);
+	if(power_state == POWER_ASLEEP) {
+		power_wake_unsafe();
+	} else {
+		power_activity = true;
+	}
+}
+#endif
+
+/// Watchdog interrupt handler, only enabled in standby.
+ISR(WDT_vect) {
+	if(power_state == POWER_ASLEEP) {
+		if(timer_advance_unsafe(POWER_TICK_MS)) {
+			task_schedule_unsafe();
+		}
+#ifndef NO_EEPROM
+		// Writes queued since the last period need the EEPROM ready interrupt
+		if(eeprom_is_busy_unsafe()) {
+			power_wake_unsafe();
+		}
+#endif
+		return;
+	}
+
+#if !defined(NO_USART) && !defined(NO_USART_SEND)
+	// Power-down would cut off the output
+	if(usart_is_sending_unsafe()) {
+		power_activity = true;
+	}
+#endif
+#ifndef NO_EEPROM
+	// The EEPROM ready interrupt cannot wake the CPU up from power-down
+	if(eeprom_is_busy_unsafe()) {
+		power_activity = true;
+	}
+#endif
+	if(power_activity) {
+		power_activity = false;
+		power_awake_ticks = POWER_AWAKE_TICKS;
+	}
+	if(--power_awake_ticks == 0) {
+		power_sleep_unsafe();
+	} else {
+		power_watch_unsafe();
+	}
+}
+
+void power_standby_enter(void) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if(power_state == POWER_ACTIVE) {
+			// Start the watchdog in interrupt mode without reset
+			wdt_reset();
+			WDTCSR = (1 << WDCE) | (1 << WDE);
+			WDTCSR = (1 << WDIE) | (1 << WDP2);
+#if !defined(NO_USART) && !defined(NO_USART_RECV)
+			PCICR |= (1 << PCIE2);
+#endif
+			// Stay awake for a while, so the pending output and EEPROM writes
+			// complete before power-down
+			power_wake_unsafe();
+			power_watch_unsafe();
+		}
+	}
+}
+
+void power_standby_exit(void) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if(power_state != POWER_ACTIVE) {
+#if !defined(NO_USART) && !defined(NO_USART_RECV)
+			PCMSK2 &= ~(1 << PCINT16);
+			PCICR &= ~(1 << PCIE2);
+#endif
+			wdt_reset();
+			WDTCSR = (1 << WDCE) | (1 << WDE);
+			WDTCSR = 0;
+			if(power_state == POWER_ASLEEP) {
+				timer_resume_unsafe();
+			}
+			set_sleep_mode(SLEEP_MODE_IDLE);
+			power_state = POWER_ACTIVE;
+		}
+	}
+}
+
+#endif // NO_POWER
@@ -0,0 +1,54 @@
+/**
+ * @file power.h
+ * Power management: turning off the unused peripherials, and the deep standby
+ * mode.
+ *
+ * In standby, the CPU sleeps in power-down mode, where only the watchdog
+ * oscillator runs. The watchdog interrupt wakes it up every
+ * @ref POWER_TICK_MS milliseconds to advance the timer, so timer waits keep
+ * working with this resolution, eg. for a heartbeat. A falling edge on the
+ * USART receive pin wakes the CPU up too: then it sleeps in idle mode with the
+ * timer and the USART running, until there was no traffic for
+ * @ref POWER_AWAKE_TICKS watchdog periods.
+ *
+ * The byte whose start bit woke the CPU up from power-down is lost, as the
+ * oscillator starts up later than it would be sampled. So the host should
+ * begin with a frame delimiter, or resend its first request if there is no
+ * reply. The watchdog oscillator is only accurate to about 10%, and so are the
+ * timer waits in standby.
+ *
+ * @copyright (C) 2018 Peter Budai
+ */
+
+#ifndef _POWER_H_
+#define _POWER_H_
+
+#ifndef NO_POWER
+
+/// Period of the watchdog interrupt in standby.
+#define POWER_TICK_MS 250
+/// Number of watchdog periods without traffic to stay awake for after it.
+#define POWER_AWAKE_TICKS 8
+
+/**
+ * Turns off the peripherials that are never used.
+ */
+void power_init(void);
+
+/**
+ * Enters standby, it returns right away. The CPU stays in idle mode for
+ * @ref POWER_AWAKE_TICKS watchdog periods, and as long as the USART is
+ * sending or the EEPROM is being written, then it goes to power-down mode
+ * when the tasks are idle. Call it after all other peripherials stopped.
+ */
+void power_standby_enter(void);
+
+/**
+ * Leaves standby, and restores the timer and the idle sleep mode.
+ * It has no effect if not in standby.
+ */
+void power_standby_exit(void);
+
+#endif // NO_POWER
+
+#endif // _POWER_H_
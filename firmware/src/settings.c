@@ -0,0 +1,106 @@
+#include "settings.h"
+
+#ifndef NO_EEPROM
+
+#include <string.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "eeprom.h"
+
+// Offsets in a record
+#define SETTINGS_SEQUENCE 0
+#define SETTINGS_MASK 2
+#define SETTINGS_VALUES 3
+#define SETTINGS_CRC (SETTINGS_RECORD_SIZE - 1)
+
+// Initial CRC value, so that neither an erased nor a zeroed slot is valid
+#define SETTINGS_CRC_INIT 0xFF
+
+// Record slots, they are zeroed when the EEPROM is programmed, which is invalid
+uint8_t settings_slots[SETTINGS_SLOT_COUNT][SETTINGS_RECORD_SIZE] EEMEM;
+
+// The current settings, in the record format
+// It is also the buffer of the EEPROM write, so it is not changed while that is in progress.
+uint8_t settings_record[SETTINGS_RECORD_SIZE];
+// Changed values, they are applied to the record when it is saved
+uint8_t settings_values[SETTINGS_COUNT];
+uint8_t settings_mask;
+// Slot of the last saved record
+uint8_t settings_slot;
+bool settings_dirty;
+
+// Returns the checksum of a record
+static uint8_t settings_crc(const uint8_t* record) {
+	uint8_t crc = SETTINGS_CRC_INIT;
+	for(uint8_t i = 0; i < SETTINGS_CRC; ++i) {
+		crc = _crc8_ccitt_update(crc, record[i]);
+	}
+	return crc;
+}
+
+// Returns the sequence number of a record
+static uint16_t settings_sequence(const uint8_t* record) {
+	return record[SETTINGS_SEQUENCE] | ((uint16_t)record[SETTINGS_SEQUENCE + 1] << 8);
+}
+
+void settings_load(void) {
+	bool found = false;
+	uint8_t record[SETTINGS_RECORD_SIZE];
+	memset(settings_record, 0, SETTINGS_RECORD_SIZE);
+	settings_slot = SETTINGS_SLOT_COUNT - 1;
+	for(uint8_t slot = 0; slot < SETTINGS_SLOT_COUNT; ++slot) {
+		eeprom_read(record, (uint16_t)settings_slots[slot], SETTINGS_RECORD_SIZE);
+		if(settings_crc(record) != record[SETTINGS_CRC]) {
+			continue;
+		}
+		// Sequence numbers wrap around, compare their distance
+		if(!found || (int16_t)(settings_sequence(record) - settings_sequence(settings_record)) > 0) {
+			memcpy(settings_record, record, SETTINGS_RECORD_SIZE);
+			settings_slot = slot;
+			found = true;
+		}
+	}
+	memcpy(settings_values, settings_record + SETTINGS_VALUES, SETTINGS_COUNT);
+	settings_mask = settings_record[SETTINGS_MASK];
+	settings_dirty = false;
+}
+
+uint8_t settings_get(uint8_t key, uint8_t fallback) {
+	return (settings_mask & (1 << key)) ? settings_values[key] : fallback;
+}
+
+void settings_set(uint8_t key, uint8_t value) {
+	if(!(settings_mask & (1 << key)) || settings_values[key] != value) {
+		settings_values[key] = value;
+		settings_mask |= (1 << key);
+		settings_dirty = true;
+	}
+}
+
+bool settings_changed(void) {
+	return settings_dirty;
+}
+
+bool settings_save(uint16_t wait_ms) {
+	if(!settings_dirty) {
+		return true;
+	}
+	// The record buffer may still be written from
+	if(!eeprom_wait(wait_ms)) {
+		return false;
+	}
+	uint16_t sequence = settings_sequence(settings_record) + 1;
+	settings_record[SETTINGS_SEQUENCE] = sequence & 0xFF;
+	settings_record[SETTINGS_SEQUENCE + 1] = sequence >> 8;
+	settings_record[SETTINGS_MASK] = settings_mask;
+	memcpy(settings_record + SETTINGS_VALUES, settings_values, SETTINGS_COUNT);
+	settings_record[SETTINGS_CRC] = settings_crc(settings_record);
+	settings_slot = (settings_slot + 1) % SETTINGS_SLOT_COUNT;
+	// The queue is empty, so the write can be queued right away
+	eeprom_write((uint16_t)settings_slots[settings_slot], settings_record, SETTINGS_RECORD_SIZE, 0);
+	settings_dirty = false;
+	return true;
+}
+
+#endif // NO_EEPROM
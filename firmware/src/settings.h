@@ -0,0 +1,90 @@
+/**
+ * @file settings.h
+ * Persistent settings store in the EEPROM.
+ *
+ * Settings are small values identified by keys, they are kept in RAM and
+ * saved as a whole record. Each save writes the next slot of a ring of records
+ * with an increasing sequence number, so the wear is spread across all slots,
+ * and a save that is interrupted by a power loss leaves the previous record
+ * intact. At startup, the newest record with a valid checksum is loaded.
+ *
+ * @copyright (C) 2018 Peter Budai
+ */
+
+#ifndef _SETTINGS_H_
+#define _SETTINGS_H_
+
+#ifndef NO_EEPROM
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Number of setting keys.
+#define SETTINGS_COUNT 8
+
+/**
+ * @name Setting keys.
+ */
+/// @{
+
+/// Index of the running application.
+#define SETTING_APP 0
+/// Frame repeat of the cube refresh.
+#define SETTING_REPEAT 1
+/// Latest frame wins mode of the frame queue.
+#define SETTING_LATEST 2
+/// Mask of the events reported on the event channel.
+#define SETTING_EVENTS 3
+/// Brightness level of the cube.
+#define SETTING_BRIGHTNESS 4
+/// Power limit of the cube.
+#define SETTING_POWER_LIMIT 5
+/// Layer period of the cube refresh, low and high byte.
+#define SETTING_LAYER_PERIOD_LOW 6
+#define SETTING_LAYER_PERIOD_HIGH 7
+
+/// @}
+
+/**
+ * Size of a record: sequence number (16 bit), mask of the stored settings,
+ * the values, and a CRC-8 of all these.
+ */
+#define SETTINGS_RECORD_SIZE (SETTINGS_COUNT + 4)
+/// Number of record slots in the EEPROM.
+#define SETTINGS_SLOT_COUNT 21
+
+/// Loads the newest valid record, or starts with no settings if there is none.
+void settings_load(void);
+
+/**
+ * Returns the value of a setting.
+ *
+ * @param key Setting key, less than @ref SETTINGS_COUNT.
+ * @param fallback Value to return if the setting is not stored.
+ */
+uint8_t settings_get(uint8_t key, uint8_t fallback);
+
+/**
+ * Changes the value of a setting in RAM, see settings_save().
+ *
+ * @param key Setting key, less than @ref SETTINGS_COUNT.
+ */
+void settings_set(uint8_t key, uint8_t value);
+
+/// Tells whether the settings were changed since they were last saved.
+bool settings_changed(void);
+
+/**
+ * Saves the settings into the next record slot, if they were changed.
+ * The record is written in the background, see eeprom_write().
+ *
+ * @param wait_ms Maximum number of milliseconds to wait for the previous
+ *     save to complete.
+ * @return True if the settings are saved or being saved.
+ *     False if the previous save was still in progress when wait_ms elapsed.
+ */
+bool settings_save(uint16_t wait_ms);
+
+#endif // NO_EEPROM
+
+#endif // _SETTINGS_H_
@@ -1,5 +1,6 @@
 #include "system.h"
 
+#include <string.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include <util/atomic.h>
@@ -8,15 +9,367 @@
 #include "cpu.h"
 #include "cube.h"
 #include "led.h"
+#include "power.h"
+#include "settings.h"
 #include "task.h"
 #include "timer.h"
 #include "usart.h"
 
 #ifndef NO_USART
 uint8_t system_recv_buffer[SYSTEM_RECV_BUFFER_SIZE];
-uint8_t system_send_buffer[SYSTEM_SEND_BUFFER_SIZE];
 fifo_t system_recv_fifo;
-fifo_t system_send_fifo;
+#ifndef NO_USART_SEND
+uint8_t system_event_buffer[SYSTEM_EVENT_BUFFER_SIZE];
+fifo_t system_event_fifo;
+#endif
+#endif
+
+// Index of the running application
+uint8_t system_app;
+
+// The system task serves commands only if the USART can both receive and send
+#if !defined(NO_USART) && !defined(NO_USART_RECV) && !defined(NO_USART_SEND)
+#define SYSTEM_COMMANDS
+#endif
+
+#ifdef SYSTEM_COMMANDS
+// Reply message being built or sent
+uint8_t system_reply[SYSTEM_REPLY_SIZE];
+// Timer value when the request being processed was received
+uint16_t system_request_time;
+// Mask of the events reported on the event channel
+uint8_t system_events;
+
+// Capabilities of this build
+#ifndef NO_CUBE
+#define SYSTEM_CAPABILITY_CUBE_BUILD SYSTEM_CAPABILITY_CUBE
+#else
+#define SYSTEM_CAPABILITY_CUBE_BUILD 0
+#endif
+#ifndef NO_LED
+#define SYSTEM_CAPABILITY_LED_BUILD SYSTEM_CAPABILITY_LED
+#else
+#define SYSTEM_CAPABILITY_LED_BUILD 0
+#endif
+#ifdef USART_COBS
+#define SYSTEM_CAPABILITY_COBS_BUILD SYSTEM_CAPABILITY_COBS
+#else
+#define SYSTEM_CAPABILITY_COBS_BUILD 0
+#endif
+#define SYSTEM_CAPABILITIES (SYSTEM_CAPABILITY_CUBE_BUILD | SYSTEM_CAPABILITY_LED_BUILD | SYSTEM_CAPABILITY_COBS_BUILD)
+
+// Link statistics command, returns the length of the reply
+static uint8_t system_command_stats(const uint8_t* args, uint8_t length) {
+	uint8_t* reply = system_reply + 1;
+	// Read the high-water marks first, as they may be reset with the counters
+	uint8_t* peaks = reply + sizeof(usart_stats_t);
+	for(uint8_t channel = 0; channel < USART_CHANNEL_COUNT; ++channel) {
+		usart_get_peaks(channel, (uint16_t*)peaks, (uint16_t*)(peaks + 2));
+		peaks += 4;
+	}
+	bool reset = length > 0 && args[0] != 0;
+	usart_get_stats((usart_stats_t*)reply, reset);
+#ifndef NO_CUBE
+	cube_get_refresh_latency((uint16_t*)peaks, (uint16_t*)(peaks + 2), reset);
+#else
+	memset(peaks, 0, 4);
+#endif
+	return peaks + 4 - system_reply;
+}
+
+// Ping command, returns the length of the reply
+static uint8_t system_command_ping(const uint8_t* args, uint8_t length) {
+	uint16_t now = timer_get_current();
+	system_reply[1] = now & 0xFF;
+	system_reply[2] = now >> 8;
+	if(length > SYSTEM_REPLY_SIZE - 3) {
+		length = SYSTEM_REPLY_SIZE - 3;
+	}
+	memcpy(system_reply + 3, args, length);
+	return length + 3;
+}
+
+// Clock synchronization command, returns the length of the reply
+static uint8_t system_command_clock(const uint8_t* args, uint8_t length) {
+	if(length > SYSTEM_REPLY_SIZE - 5) {
+		length = SYSTEM_REPLY_SIZE - 5;
+	}
+	memcpy(system_reply + 5, args, length);
+	// Take the send time as late as possible
+	uint16_t now = timer_get_current();
+	system_reply[1] = system_request_time & 0xFF;
+	system_reply[2] = system_request_time >> 8;
+	system_reply[3] = now & 0xFF;
+	system_reply[4] = now >> 8;
+	return length + 5;
+}
+
+// Rendering cost command, returns the length of the reply
+static uint8_t system_command_profile(const uint8_t* args, uint8_t length) {
+	uint32_t last;
+	uint32_t peak;
+	app_get_render_cycles(&last, &peak, length > 0 && args[0] != 0);
+	for(uint8_t i = 0; i < 4; ++i) {
+		system_reply[1 + i] = last >> (8 * i);
+		system_reply[5 + i] = peak >> (8 * i);
+	}
+	return 9;
+}
+
+// Reset source and crash record command, returns the length of the reply
+static uint8_t system_command_crash(const uint8_t* args, uint8_t length) {
+	cpu_crash_record_t record;
+	cpu_get_crash(&record, length > 0 && args[0] != 0);
+	system_reply[1] = cpu_reset_flags;
+	system_reply[2] = record.reason;
+	system_reply[3] = record.task;
+	system_reply[4] = record.sp & 0xFF;
+	system_reply[5] = record.sp >> 8;
+	system_reply[6] = record.time & 0xFF;
+	system_reply[7] = record.time >> 8;
+	return 8;
+}
+
+// Version and capabilities command, returns the length of the reply
+static uint8_t system_command_version(void) {
+	system_reply[1] = SYSTEM_VERSION_MAJOR;
+	system_reply[2] = SYSTEM_VERSION_MINOR;
+	system_reply[3] = SYSTEM_CAPABILITIES;
+	system_reply[4] = APP_COUNT;
+	system_reply[5] = USART_CHANNEL_COUNT;
+#ifndef NO_CUBE
+	system_reply[6] = cube_get_buffer_count();
+	system_reply[7] = CUBE_FRAME_SIZE;
+#else
+	system_reply[6] = 0;
+	system_reply[7] = 0;
+#endif
+	return 8;
+}
+#endif
+
+// Stops the running application, and starts the given one in its place
+static void system_switch_app(uint8_t app) {
+	task_stop(APP_TASK);
+#ifndef NO_POWER
+	// Only the standby app enters standby
+	power_standby_exit();
+#endif
+	// Lay out the memory of the new application, this drops the frames and the
+	// traffic of the old one
+	if(!app_layout(app)) {
+		// It does not fit, the standby app always does
+		app = 0;
+		app_layout(app);
+	}
+	system_app = app;
+#ifndef NO_EEPROM
+	// The new application starts with the default frame queue mode
+	settings_set(SETTING_APP, app);
+	settings_set(SETTING_LATEST, false);
+#endif
+	task_start(APP_TASK, apps[app].func);
+}
+
+#ifdef SYSTEM_COMMANDS
+// Switch application command, returns the length of the reply
+static uint8_t system_command_app(const uint8_t* args, uint8_t length) {
+	if(length > 0 && args[0] < APP_COUNT) {
+		system_switch_app(args[0]);
+	}
+	system_reply[1] = system_app;
+	return 2;
+}
+
+#ifndef NO_CUBE
+// Refresh parameters command, returns the length of the reply
+static uint8_t system_command_refresh(const uint8_t* args, uint8_t length) {
+	if(length > 0) {
+		cube_set_repeat(args[0]);
+#ifndef NO_EEPROM
+		settings_set(SETTING_REPEAT, cube_get_repeat());
+#endif
+	}
+	if(length > 2) {
+		cube_set_layer_period(args[1] | (args[2] << 8));
+#ifndef NO_EEPROM
+		uint16_t period = cube_get_layer_period();
+		settings_set(SETTING_LAYER_PERIOD_LOW, period & 0xFF);
+		settings_set(SETTING_LAYER_PERIOD_HIGH, period >> 8);
+#endif
+	}
+	uint16_t period = cube_get_layer_period();
+	system_reply[1] = cube_get_repeat();
+	system_reply[2] = period & 0xFF;
+	system_reply[3] = period >> 8;
+	return 4;
+}
+
+// Brightness command, returns the length of the reply
+static uint8_t system_command_brightness(const uint8_t* args, uint8_t length) {
+	if(length > 0) {
+		cube_set_brightness(args[0]);
+#ifndef NO_EEPROM
+		settings_set(SETTING_BRIGHTNESS, args[0]);
+#endif
+	}
+	if(length > 1) {
+		cube_set_power_limit(args[1]);
+#ifndef NO_EEPROM
+		settings_set(SETTING_POWER_LIMIT, cube_get_power_limit());
+#endif
+	}
+	uint16_t lit = cube_get_lit_voxels();
+	system_reply[1] = cube_get_brightness();
+	system_reply[2] = cube_get_power_limit();
+	system_reply[3] = lit & 0xFF;
+	system_reply[4] = lit >> 8;
+	return 5;
+}
+
+// Frame queue command, returns the length of the reply
+static uint8_t system_command_queue(const uint8_t* args, uint8_t length) {
+	if(length > 0) {
+		cube_set_latest(args[0] != 0);
+#ifndef NO_EEPROM
+		settings_set(SETTING_LATEST, args[0] != 0);
+#endif
+	}
+	uint16_t latency = cube_get_latency();
+	system_reply[1] = cube_get_latest();
+	system_reply[2] = cube_get_queued_frames();
+	system_reply[3] = cube_get_free_frames();
+	system_reply[4] = latency & 0xFF;
+	system_reply[5] = latency >> 8;
+	return 6;
+}
+
+// Reports a frame switch on the event channel, called by the cube refresh
+static bool system_frame_event(const cube_frame_event_t* event) {
+	uint8_t record[SYSTEM_EVENT_RECORD_SIZE] = {
+		SYSTEM_EVENT_FRAME,
+		event->sequence & 0xFF, event->sequence >> 8,
+		event->time & 0xFF, event->time >> 8,
+		event->id
+	};
+	usart_post_unsafe(USART_CHANNEL_EVENT, record, sizeof(record));
+	return false;
+}
+
+// Turns event reports on or off
+static void system_set_events(uint8_t mask) {
+	system_events = mask & SYSTEM_EVENT_MASK(SYSTEM_EVENT_FRAME);
+	cube_set_frame_callback((system_events & SYSTEM_EVENT_MASK(SYSTEM_EVENT_FRAME)) ? system_frame_event : NULL);
+#ifndef NO_EEPROM
+	settings_set(SETTING_EVENTS, system_events);
+#endif
+}
+
+// Event reports command, returns the length of the reply
+static uint8_t system_command_events(const uint8_t* args, uint8_t length) {
+	if(length > 0) {
+		system_set_events(args[0]);
+	}
+	system_reply[1] = system_events;
+	return 2;
+}
+#endif
+
+// Processes a request message, and sends its reply
+static void system_handle_request(const uint8_t* request, uint8_t length) {
+	uint8_t command = request[0];
+	const uint8_t* args = request + 1;
+	uint8_t reply_length;
+	length--;
+	switch(command) {
+		case SYSTEM_COMMAND_STATS:
+			reply_length = system_command_stats(args, length);
+			break;
+		case SYSTEM_COMMAND_PING:
+			reply_length = system_command_ping(args, length);
+			break;
+		case SYSTEM_COMMAND_CLOCK:
+			reply_length = system_command_clock(args, length);
+			break;
+		case SYSTEM_COMMAND_VERSION:
+			reply_length = system_command_version();
+			break;
+		case SYSTEM_COMMAND_PROFILE:
+			reply_length = system_command_profile(args, length);
+			break;
+		case SYSTEM_COMMAND_CRASH:
+			reply_length = system_command_crash(args, length);
+			break;
+		case SYSTEM_COMMAND_APP:
+			reply_length = system_command_app(args, length);
+			break;
+#ifndef NO_CUBE
+		case SYSTEM_COMMAND_REFRESH:
+			reply_length = system_command_refresh(args, length);
+			break;
+		case SYSTEM_COMMAND_EVENTS:
+			reply_length = system_command_events(args, length);
+			break;
+		case SYSTEM_COMMAND_BRIGHTNESS:
+			reply_length = system_command_brightness(args, length);
+			break;
+		case SYSTEM_COMMAND_QUEUE:
+			reply_length = system_command_queue(args, length);
+			break;
+		case SYSTEM_COMMAND_FLUSH:
+			cube_flush();
+			reply_length = system_command_queue(args, 0);
+			break;
+#endif
+		default:
+			system_reply[1] = command;
+			command = SYSTEM_REPLY_UNKNOWN;
+			reply_length = 2;
+			break;
+	}
+	usart_release_message(USART_CHANNEL_SYSTEM);
+
+	// Send the reply buffer as is, and wait until it can be reused
+	usart_segment_t segment = { system_reply, reply_length };
+	system_reply[0] = command;
+	if(usart_send_segments(USART_CHANNEL_SYSTEM, &segment, 1, TIMER_INFINITE)) {
+		usart_wait_sent(USART_CHANNEL_SYSTEM, TIMER_INFINITE);
+	}
+}
+#endif
+
+#ifndef NO_EEPROM
+// Restores the configuration saved before the last reset, and starts the
+// application that was running then, unless it crashed
+static void system_restore(void) {
+	settings_load();
+	uint8_t app = settings_get(SETTING_APP, SYSTEM_DEFAULT_APP);
+	if(cpu_reset_flags & (1 << WDRF)) {
+		// Restarting the crashed application could end up in a reset loop
+		cpu_crash_record_t record;
+		cpu_get_crash(&record, false);
+		if(record.reason != CPU_CRASH_NONE) {
+			app = SYSTEM_CRASH_APP;
+		}
+	}
+#ifndef NO_CUBE
+	bool latest = settings_get(SETTING_LATEST, false);
+	cube_set_repeat(settings_get(SETTING_REPEAT, CUBE_DEFAULT_REPEAT));
+	cube_set_layer_period(settings_get(SETTING_LAYER_PERIOD_LOW, CUBE_DEFAULT_LAYER_PERIOD & 0xFF)
+		| (settings_get(SETTING_LAYER_PERIOD_HIGH, CUBE_DEFAULT_LAYER_PERIOD >> 8) << 8));
+	cube_set_brightness(settings_get(SETTING_BRIGHTNESS, CUBE_BRIGHTNESS_MAX));
+	cube_set_power_limit(settings_get(SETTING_POWER_LIMIT, 0));
+#endif
+	system_switch_app(app < APP_COUNT ? app : SYSTEM_DEFAULT_APP);
+#ifndef NO_CUBE
+	// Starting the application resets the frame queue mode
+	cube_set_latest(latest);
+	settings_set(SETTING_LATEST, latest);
+#ifdef SYSTEM_COMMANDS
+	system_set_events(settings_get(SETTING_EVENTS, 0));
+#endif
+#endif
+}
 #endif
 
 void system_task_init(void) {
@@ -26,9 +379,15 @@ void system_task_init(void) {
 #ifndef NO_USART
 	// Init USART buffers
     fifo_init(&system_recv_fifo, system_recv_buffer, SYSTEM_RECV_BUFFER_SIZE);
-    fifo_init(&system_send_fifo, system_send_buffer, SYSTEM_SEND_BUFFER_SIZE);
-	tasks[SYSTEM_TASK].recv_fifo = &system_recv_fifo;
-	tasks[SYSTEM_TASK].send_fifo = &system_send_fifo;
+	// Replies are sent as zero-copy messages, no send buffer is needed
+	usart_route(USART_CHANNEL_SYSTEM, SYSTEM_TASK, &system_recv_fifo, NULL);
+#ifndef NO_USART_SEND
+	fifo_init(&system_event_fifo, system_event_buffer, SYSTEM_EVENT_BUFFER_SIZE);
+	usart_route(USART_CHANNEL_EVENT, SYSTEM_TASK, NULL, &system_event_fifo);
+#endif
+#endif
+#ifdef SYSTEM_COMMANDS
+	usart_set_message_mode(USART_CHANNEL_SYSTEM, true);
 #endif
 }
 
@@ -46,14 +405,44 @@ void system_run(void) {
 #endif
 #ifndef NO_USART
 		usart_init();
+#endif
+#ifndef NO_POWER
+		power_init();
 #endif
 		set_sleep_mode(SLEEP_MODE_IDLE);
 	}
 
 	// Start running background operations
-	task_start(APP_TASK, apps[1]);
+#ifndef NO_EEPROM
+	system_restore();
+#else
+	system_switch_app(SYSTEM_DEFAULT_APP);
+#endif
 	for(;;) {
+#ifdef SYSTEM_COMMANDS
+		// Serve the requests of the remote host
+		uint16_t wait_ms = TIMER_INFINITE;
+#ifndef NO_EEPROM
+		if(settings_changed()) {
+			wait_ms = SYSTEM_SETTINGS_DELAY;
+		}
+#endif
+		uint8_t length;
+		const uint8_t* request = usart_receive_message(USART_CHANNEL_SYSTEM, &length, wait_ms);
+		// The task may run well after the request arrived, eg. as its wake-up is
+		// deferred to the cube refresh, so take the time when the frame ended
+		system_request_time = usart_get_receive_time(USART_CHANNEL_SYSTEM);
+		if(request != NULL) {
+			system_handle_request(request, length);
+			continue;
+		}
+#else
 		timer_wait(1000);
+#endif
+#ifndef NO_EEPROM
+		// The host is idle, save the changed settings
+		settings_save(0);
+#endif
 	}
 
 	// Disable all peripherials and interrupt sources
@@ -5,9 +5,132 @@
 
 #define SYSTEM_TASK 0
 #define SYSTEM_STACK_START (IDLE_STACK_START - IDLE_STACK_SIZE)
-#define SYSTEM_STACK_SIZE 96
+#define SYSTEM_STACK_SIZE 128
+// USART buffer sizes must be powers of two
 #define SYSTEM_RECV_BUFFER_SIZE 32
-#define SYSTEM_SEND_BUFFER_SIZE 64
+#define SYSTEM_EVENT_BUFFER_SIZE 32
+// Replies are sent as zero-copy messages from this buffer
+#define SYSTEM_REPLY_SIZE 48
+
+// Firmware version reported to the remote host
+#define SYSTEM_VERSION_MAJOR 1
+#define SYSTEM_VERSION_MINOR 0
+
+// Capability flags reported to the remote host
+#define SYSTEM_CAPABILITY_CUBE 0x01
+#define SYSTEM_CAPABILITY_LED 0x02
+#define SYSTEM_CAPABILITY_COBS 0x04
+
+// Application started after reset, unless another one was running before
+#define SYSTEM_DEFAULT_APP 1
+// Application started after a watchdog reset that left a crash record, instead
+// of the one running before, which may crash again right away
+#define SYSTEM_CRASH_APP 0
+
+// Changed settings are saved when no request arrived for this many milliseconds,
+// so a burst of changes wears the EEPROM only once
+#define SYSTEM_SETTINGS_DELAY 1000
+
+// System channel commands
+// The system channel is in message mode: each request message starts with a
+// command byte, and its reply message starts with the same byte. Multi-byte
+// values are little-endian.
+
+// Link statistics: [0x01] or [0x01][reset]
+// Reply: [0x01][usart_stats_t][recv peak, send peak of each channel (16 bit)]
+//     [earliest, latest cube refresh start in microseconds (16 bit)]
+// If reset is non-zero, the counters and high-water marks are reset after reading.
+// The refresh starts are measured from the refresh timer compare match, their
+// spread is the refresh jitter, see cube_get_refresh_latency(). Without the
+// cube, they are 0.
+#define SYSTEM_COMMAND_STATS 0x01
+
+// Ping: [0x02][any data]
+// Reply: [0x02][current timer value (16 bit)][the same data]
+// The host can measure the round-trip time, and relate its clock to the timer.
+#define SYSTEM_COMMAND_PING 0x02
+
+// Version and capabilities: [0x03]
+// Reply: [0x03][major][minor][capability flags][app count][channel count]
+//     [frame buffer count of the running application][frame size]
+#define SYSTEM_COMMAND_VERSION 0x03
+
+// Switch application: [0x04] or [0x04][app index]
+// The running application is stopped, its channel buffers are cleared, and the
+// given one is started. Without an index, nothing changes.
+// Reply: [0x04][index of the running application]
+#define SYSTEM_COMMAND_APP 0x04
+
+// Refresh parameters: [0x05] or [0x05][frame repeat] or
+//     [0x05][frame repeat][layer period in microseconds (16 bit)]
+// Sets how many times each frame is displayed, at least 1, and how long each
+// layer is displayed, between 250 and 8000 us. The frame period is
+// 8 * layer period * frame repeat.
+// Reply: [0x05][frame repeat][layer period (16 bit)]
+#define SYSTEM_COMMAND_REFRESH 0x05
+
+// Frame queue status and mode: [0x06] or [0x06][latest frame wins mode]
+// Reply: [0x06][latest frame wins mode][queued frames][free frames]
+//     [display latency in ms (16 bit)]
+#define SYSTEM_COMMAND_QUEUE 0x06
+
+// Flush the frame queue, display the newest frame right away: [0x07]
+// Reply: [0x07] and the same queue status as above
+#define SYSTEM_COMMAND_FLUSH 0x07
+
+// Clock synchronization: [0x08][any data, eg. the host send time]
+// Reply: [0x08][timer value when the request was received (16 bit)]
+//     [timer value when the reply was sent (16 bit)][the same data]
+// It is like an NTP exchange: the host can estimate the offset and the drift
+// of the timer relative to its clock from a series of them, to schedule timed
+// frames. The receive time is that of the latest system frame, so the host
+// should wait for the reply before sending the next request.
+#define SYSTEM_COMMAND_CLOCK 0x08
+
+// Event reports: [0x09] or [0x09][event mask]
+// Turns on the reports of the events whose bits are set in the mask (bit 0 for
+// event type 1, and so on), and turns off the others. They are sent on the event
+// channel, see below.
+// Reply: [0x09][event mask]
+#define SYSTEM_COMMAND_EVENTS 0x09
+
+// Rendering cost of the running application: [0x0A] or [0x0A][reset]
+// Reply: [0x0A][CPU cycles of the last frame (32 bit)][most cycles of a frame (32 bit)]
+// Only the applications that render their frames on the cube report it, the
+// others report 0. If reset is non-zero, the peak is reset after reading.
+#define SYSTEM_COMMAND_PROFILE 0x0A
+
+// Reset source and crash record: [0x0B] or [0x0B][clear]
+// Reply: [0x0B][MCU status register at the last reset][crash reason][task]
+//     [stack pointer (16 bit)][timer value (16 bit)]
+// The crash record is kept across resets until power loss, its reason is 0
+// if no crash was recorded. If clear is non-zero, it is cleared after reading.
+#define SYSTEM_COMMAND_CRASH 0x0B
+
+// Brightness and power limit: [0x0C] or [0x0C][brightness] or
+//     [0x0C][brightness][power limit]
+// Reply: [0x0C][brightness][power limit][lit voxels of the last layer cycle (16 bit)]
+// Brightness is the portion of its time slot each layer is lit for, 255 is
+// all of it. The power limit is the average number of lit voxels per layer
+// at full brightness that the cube is dimmed to stay below, at most 64, 0 turns
+// it off. The lit voxels are only counted while the limit is on.
+#define SYSTEM_COMMAND_BRIGHTNESS 0x0C
+
+// Reply to an unknown command: [0xFF][command]
+#define SYSTEM_REPLY_UNKNOWN 0xFF
+
+// Event channel reports
+// The event channel carries a stream of fixed size records:
+//     [event type][sequence number (16 bit)][timer value (16 bit)][frame id]
+// Records are dropped if the remote host does not keep up with them.
+
+// A new frame was selected for display, the time is when it happened (its first
+// layer is displayed in the next layer period). The sequence number counts the
+// frame switches, the frame id is the one the frame was tagged with by the
+// application, eg. the streaming app takes it from the host.
+#define SYSTEM_EVENT_FRAME 0x01
+#define SYSTEM_EVENT_RECORD_SIZE 6
+#define SYSTEM_EVENT_MASK(type) (1 << ((type) - 1))
 
 void system_task_init(void);
 
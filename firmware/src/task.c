@@ -4,8 +4,14 @@
 #include <avr/io.h>
 #include <util/atomic.h>
 
+#include "timer.h"
+#include "usart.h"
+
 task_t tasks[TASK_COUNT];
 uint8_t current_task;
+// Whether task switches of interrupt handlers are deferred, and whether one is pending
+bool task_deferral;
+bool task_deferred;
 
 #define STACK_CANARY ((uint16_t)0x53CA)
 
@@ -36,10 +42,6 @@ void task_init(uint8_t id, void* stack_start, size_t stack_size) {
 	stack_store_addr(tasks[id].stack_start, task_exit);
 	tasks[id].stack_end = stack_start - stack_size + 1;
 	stack_store_canary(tasks[id].stack_end);
-#ifndef NO_USART
-	tasks[id].recv_fifo = NULL;
-	tasks[id].send_fifo = NULL;
-#endif
 }
 
 void task_start(uint8_t id, task_func_t func) {
@@ -73,9 +75,8 @@ void task_start(uint8_t id, task_func_t func) {
 	tasks[id].stack = stack;
 
 #ifndef NO_USART
-	// Reset FIFOs
-	fifo_clear(tasks[id].recv_fifo);
-	fifo_clear(tasks[id].send_fifo);
+	// The new run of the task must not see the data left by the previous one
+	usart_reset_task(id);
 #endif
 
 	// Enable
@@ -111,7 +112,7 @@ void task_yield(void) {
 void tasks_run(void) {
 	// Initialize idle task.
 	// It is initialized only this far (task_start() is not called) on purpose:
-	//  - Idle task doesn't need FIFO.
+	//  - Idle task doesn't need USART channels.
 	//  - The idle task shares the same stack as this function, so the stack
 	//    need not be bothered with.
 	// This setup will cause that the idle task will take the place of the
@@ -259,7 +260,30 @@ task_t* task_current_unsafe(void) {
 	return &tasks[current_task];
 }
 
+void task_wake_unsafe(void) {
+	if(task_deferral) {
+		task_deferred = true;
+	} else {
+		task_schedule_unsafe();
+	}
+}
+
+void task_set_deferral_unsafe(bool enabled) {
+	task_deferral = enabled;
+	if(!enabled && task_deferred) {
+		task_schedule_unsafe();
+	}
+}
+
+bool task_take_deferred_unsafe(void) {
+	bool deferred = task_deferred;
+	task_deferred = false;
+	return deferred;
+}
+
 void task_schedule_unsafe(void) {
+	// Any pending deferred switch is done by this one
+	task_deferred = false;
 	uint8_t next_task;
 	for(next_task = 0; next_task < TASK_COUNT; ++next_task) {
 		if((tasks[next_task].status & TASK_SCHEDULED) && !(tasks[next_task].status & TASK_WAITING)) {
@@ -269,7 +293,17 @@ void task_schedule_unsafe(void) {
 
 	if(next_task >= TASK_COUNT || !stack_check_canary(tasks[next_task].stack_end)) {
 		// Error condition: no runnable task or stack overflow
-		cpu_reset();
+#ifndef NO_TIMER
+		uint16_t time = timer_get_current_unsafe();
+#else
+		uint16_t time = 0;
+#endif
+		if(next_task >= TASK_COUNT) {
+			cpu_crash(CPU_CRASH_DEADLOCK, current_task, SP, time);
+		}
+		// The running task has no saved stack pointer
+		uint16_t sp = (next_task == current_task) ? SP : (uint16_t)tasks[next_task].stack;
+		cpu_crash(CPU_CRASH_STACK, next_task, sp, time);
 	}
 	if(next_task != current_task) {
 		task_switch_unsafe(next_task);
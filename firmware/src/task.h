@@ -1,15 +1,15 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
 #include "cpu.h"
-#include "fifo.h"
 
 /// Task status bits
 #define TASK_STOPPED 0x00
 #define TASK_SCHEDULED 0x80
-#define TASK_WAITING 0x0F
+#define TASK_WAITING 0x1F
 #ifndef NO_CUBE
 #define TASK_WAIT_CUBE 0x01
 #endif
@@ -20,6 +20,9 @@
 #ifndef NO_TIMER
 #define TASK_WAIT_TIMER 0x08
 #endif
+#ifndef NO_EEPROM
+#define TASK_WAIT_EEPROM 0x10
+#endif
 
 /// Task descriptor.
 typedef struct task {
@@ -27,10 +30,6 @@ typedef struct task {
 	void* stack;
 	void* stack_start;
 	void* stack_end;
-#ifndef NO_USART
-	fifo_t* recv_fifo;
-	fifo_t* send_fifo;
-#endif
 #ifndef NO_TIMER
 	uint16_t wait_until;
 #endif
@@ -51,9 +50,9 @@ typedef void (*task_func_t)(void);
 extern task_t tasks[];
 
 /**
- * Initializes the given task slot: stack boundaries and status, but not FIFOs.
+ * Initializes the given task slot: stack boundaries and status.
  * This must be called before using the task slot. If the task uses network,
- * the FIFOs must be initialized as well.
+ * its USART channels must be routed as well.
  * @param id Task slot identifier.
  * @param stack_start Stack start address (the highest address, stack grows downwards from here)
  * @param stack_size Available stack size for this task.
@@ -112,4 +111,26 @@ task_t* task_current_unsafe(void);
  */
 void task_schedule_unsafe(void);
 
+/**
+ * Schedules the woken up tasks from an interrupt handler. When deferral is on,
+ * the task switch is only recorded, and it is done later by the handler that
+ * took it over, see task_take_deferred_unsafe(), so this interrupt handler
+ * returns quickly. Otherwise it is the same as task_schedule_unsafe().
+ */
+void task_wake_unsafe(void);
+
+/**
+ * Turns deferral of the task switches of task_wake_unsafe() on or off.
+ * The caller takes over doing the deferred switches regularly while it is on.
+ * Turning it off does the pending one right away.
+ */
+void task_set_deferral_unsafe(bool enabled);
+
+/**
+ * Tells whether a task switch has been deferred, and clears it.
+ *
+ * @return True if task_schedule_unsafe() should be called.
+ */
+bool task_take_deferred_unsafe(void);
+
 /// @}
@@ -7,31 +7,47 @@
 #include <util/atomic.h>
 
 #include "cpu.h"
-#include "cube.h"
 #include "task.h"
+#include "usart.h"
+
+/// Clock source divider of the timer counter.
+#define TIMER_PRESCALER 64
+/// Counter compare value of one timer tick, the counter goes from 0 to this value.
+#define TIMER_TOP (F_CPU / TIMER_PRESCALER / TIMER_FREQ)
+/// Period of the cycle count returned by timer_get_cycles().
+#define TIMER_CYCLES_WRAP ((uint32_t)(UINT16_MAX + 1UL) * (TIMER_TOP + 1) * TIMER_PRESCALER)
 
 /// Continuously incrementing value at each timer tick.
 uint16_t timer_value;
 
+// Wakes up the tasks whose wait ended within the last count ticks, up to the current timer value
+static bool timer_wake_unsafe(uint16_t count) {
+	bool wake = false;
+	for(uint8_t i = 0; i < TASK_COUNT; ++i) {
+		if((tasks[i].status & TASK_WAIT_TIMER) && (uint16_t)(timer_value - tasks[i].wait_until) < count) {
+			// Remove any wait flags if timeout reached
+			tasks[i].status &= ~TASK_WAITING;
+			wake = true;
+		}
+	}
+	return wake;
+}
+
 /// Timer interrupt handler, called once per millisecond.
 ISR(TIMER0_COMPA_vect) {
 	// Increase timer and let it overflow
 	++timer_value;
 
-#ifndef NO_CUBE
-	// Drive cube refresh
-	bool wake = cube_refresh();
-#else
 	bool wake = false;
+
+#if !defined(NO_USART) && !defined(NO_USART_SEND)
+	// Drive coalesced USART output
+	usart_tick();
 #endif
 
 	// Handle tasks that are waiting for timer
-	for(uint8_t i = 0; i < TASK_COUNT; ++i) {
-		if((tasks[i].status & TASK_WAIT_TIMER) && tasks[i].wait_until == timer_value) {
-			// Remove any wait flags if timeout reached
-			tasks[i].status &= ~TASK_WAITING;
-			wake = true;
-		}
+	if(timer_wake_unsafe(1)) {
+		wake = true;
 	}
 
 	if(wake) {
@@ -44,7 +60,7 @@ void timer_init(void)
 	// Reset timer
 	TCNT0 = 0x00;
 	// Set interval to 1000 Hz
-	OCR0A = F_CPU / 64 / TIMER_FREQ;
+	OCR0A = TIMER_TOP;
 	// Set CTC mode
 	TCCR0A = (1 << WGM01);
 	// Set clock source to F_CPU/64
@@ -63,6 +79,20 @@ void timer_stop(void) {
 	}
 }
 
+void timer_suspend_unsafe(void) {
+	// Stop the clock source, the counter keeps its value
+	TCCR0B = 0;
+}
+
+void timer_resume_unsafe(void) {
+	TCCR0B = (1 << CS01) | (1 << CS00);
+}
+
+bool timer_advance_unsafe(uint16_t ms) {
+	timer_value += ms;
+	return timer_wake_unsafe(ms);
+}
+
 uint16_t timer_get_current_unsafe(void) {
 	return timer_value;
 }
@@ -99,6 +129,25 @@ bool timer_has_elapsed(uint16_t since, uint16_t ms) {
 	return result;
 }
 
+uint32_t timer_get_cycles(void) {
+	uint16_t value;
+	uint8_t count;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		value = timer_value;
+		count = TCNT0;
+		// The counter may have been restarted, while its interrupt is still pending
+		if((TIFR0 & (1 << OCF0A)) && count < TIMER_TOP) {
+			++value;
+		}
+	}
+	return ((uint32_t)value * (TIMER_TOP + 1) + count) * TIMER_PRESCALER;
+}
+
+uint32_t timer_get_cycles_elapsed(uint32_t since) {
+	uint32_t now = timer_get_cycles();
+	return since <= now ? now - since : TIMER_CYCLES_WRAP - since + now;
+}
+
 void timer_wait(uint16_t ms) {
 	if(ms > 0) {
 		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
@@ -2,8 +2,8 @@
  * @file timer.h
  * Millisecond resolution timer.
  * This library to be used in applications where precise timing is required.
- * It also drives other periodically refreshing output peripherials like the
- * LED cube and the status LED.
+ * It also drives other periodically refreshing peripherials like the USART
+ * output coalescing. The LED cube is refreshed by its own timer, see cube.h.
  *
  * @copyright (C) 2017 Peter Budai
  */
@@ -62,6 +62,23 @@ uint16_t timer_get_elapsed(uint16_t since);
  */
 bool timer_has_elapsed(uint16_t since, uint16_t wait_ms);
 
+/**
+ * Returns a free-running count of CPU clock cycles, for measuring short
+ * durations with timer_get_cycles_elapsed(). Its resolution is the timer
+ * prescaler, 64 cycles, and it wraps around together with the millisecond timer.
+ */
+uint32_t timer_get_cycles(void);
+
+/**
+ * Returns the number of CPU clock cycles that has elapsed since a given time.
+ * The time spent in interrupt handlers and other tasks meanwhile is included.
+ *
+ * @param since A previous value obtained from timer_get_cycles().
+ * @return Number of elapsed cycles.
+ *     If more than UINT16_MAX milliseconds elapsed, the result is undefined.
+ */
+uint32_t timer_get_cycles_elapsed(uint32_t since);
+
 /**
  * @name Faster, but thread unsafe versions.
  * Call these function only when interrupts are disabled.
@@ -98,6 +115,26 @@ uint16_t timer_get_elapsed_unsafe(uint16_t since);
  */
 bool timer_has_elapsed_unsafe(uint16_t since, uint16_t wait_ms);
 
+/**
+ * Stops counting milliseconds, eg. before entering a sleep mode that stops the
+ * timer clock anyway. The time can be kept with timer_advance_unsafe() meanwhile.
+ */
+void timer_suspend_unsafe(void);
+
+/**
+ * Continues counting milliseconds after timer_suspend_unsafe().
+ */
+void timer_resume_unsafe(void);
+
+/**
+ * Advances the timer by the given amount of time at once, while it is
+ * suspended, and ends the waits that expire in the meantime.
+ *
+ * @param ms Number of milliseconds to advance.
+ * @return True if a task was woken up, and it needs to be scheduled.
+ */
+bool timer_advance_unsafe(uint16_t ms);
+
 /// @}
 
 /**
@@ -5,6 +5,7 @@
 #define BAUD 38400
 
 #include <stdlib.h>
+#include <string.h>
 #include <avr/interrupt.h>
 #include <avr/io.h>
 #include <util/atomic.h>
@@ -17,17 +18,20 @@
 #include "timer.h"
 
 // Framing constants
+#ifndef USART_COBS
 #define USART_FRAME_BYTE 0x7E
 #define USART_ESCAPE_BYTE 0x7D
 #define USART_ESCAPE_MASK 0x20
+#else
+#define USART_FRAME_BYTE 0x00
+#define USART_BLOCK_MAX 0xFF
+// Number of bytes the transmitter looks ahead for a zero byte in an interrupt,
+// this bounds how long the interrupt handler runs
+#define USART_SCAN_STEP 4
+#endif
 
-// Framing helper macros
-#define USART_ADDRESS_BITS 1
-#define USART_LENGTH_BITS (8 - USART_ADDRESS_BITS)
-#define USART_LENGTH_MAX ((1 << USART_LENGTH_BITS) - 1)
-#define usart_get_message_address(header) ((header) >> USART_LENGTH_BITS)
-#define usart_get_message_length(header) ((header) & USART_LENGTH_MAX)
-#define usart_get_message_header(address, length) (((address) << USART_LENGTH_BITS) | ((length) & USART_LENGTH_MAX))
+// Length of a frame payload is stored in a single byte
+#define USART_LENGTH_MAX UINT8_MAX
 
 // Despite the connection between the remote computer/phone and the LED cube board's
 // Bluetooth module is a reliable RFCOMM stream, we need to implement proper framing
@@ -47,13 +51,14 @@
 //   will never contain the frame delimiter (0x7E).
 //
 // The frame also has an inner structure, which is a simple, custom-made protocol:
-// - A frame always starts with a header byte.
-//   - The upper bit(s) identifies the task that sent, or should receive the frame.
-//     Currently there are two useful tasks, to the address fits in one bit.
-//   - The lower bits hold how many bytes of payload follows the header byte.
-//     All remaining 7 bits allow for lengths between 0 to 127.
-// - Then an arbitrary payload follows with a length between 0 to 127 bytes. Although
-//   a payload length of 0 is valid, it is not used.
+// - A frame always starts with a channel byte that identifies the logical channel
+//   the frame was sent on, or should be delivered to. The routing table maps each
+//   channel to a pair of FIFOs (and to a sink callback, optionally), so every kind
+//   of traffic has its own buffers and does not block the others.
+//   Frames addressed to an unknown or unrouted channel are dropped.
+// - Then a length byte holds how many bytes of payload follow, 0 to 255.
+// - Then an arbitrary payload follows with the given length. Although a payload
+//   length of 0 is valid, it is not used.
 // - Finally, a footer byte closes the frame: it the a CRC-8-CCITT checksum of the
 //   header and the payload. It is there to protect against dropped data or framing
 //   bytes.
@@ -62,19 +67,78 @@
 // - All frame bytes are subject to escaping if necessary, including the header, the
 //   payload and the checksum, as well.
 //
-//    ... -+---------+----------+--------- ... --------+----------+---------+- ...
-//         |  0x7E   | ALLLLLLL |    (length bytes)    |  CRC-8   |  0x7E   |
-//    ... -+---------+----------+--------- ... --------+----------+---------+- ...
-//   prev.   framing    header           payload          footer    framing   next
-//   frame    byte                                                   byte     frame
+//    ... -+---------+----------+----------+--------- ... --------+----------+---------+- ...
+//         |  0x7E   | channel  |  length  |    (length bytes)    |  CRC-8   |  0x7E   |
+//    ... -+---------+----------+----------+--------- ... --------+----------+---------+- ...
+//   prev.   framing       header                  payload           footer    framing   next
+//   frame    byte                                                              byte     frame
 //
 // Therefore for a 64-byte payload (eg. a whole cube frame), the framing overhead
-// is 4 bytes (6%). For a worst case scenario of all data bytes escaped, the frame
-// becomes 134 bytes long: for a 25 FPS data transfer it needs a bandwidth of
-// 3350 bytes per sec, or 33500 baud. With the 38400 baud rate we use here, we still
-// have room for almost 4 frame retransmissions (15% packet loss).
+// is 5 bytes (8%). For a worst case scenario of all data bytes escaped, the frame
+// becomes 136 bytes long: for a 25 FPS data transfer it needs a bandwidth of
+// 3400 bytes per sec, or 34000 baud. With the 38400 baud rate we use here, we still
+// have some room for retransmissions (11% packet loss).
 // Under normal circumstances, this protocol and the bandwidth should be fine for
 // smooth animation streaming from the host device to the LED cube.
+//
+// When USART_COBS is defined, Consistent Overhead Byte Stuffing is used instead of
+// escaping, with the same inner frame structure:
+// - Each frame begins and ends with a zero delimiter byte (0x00), with the same
+//   sharing and repetition rules as above.
+// - The frame data is split into blocks at its zero bytes. Each block is sent as a
+//   code byte that holds the block length plus one, followed by the non-zero bytes
+//   of the block. The zero byte that ends the block is not sent, it is implied by
+//   the next code byte.
+// - A block without zero (code 0xFF) holds 254 bytes, and it implies no zero byte.
+// - Therefore the overhead of a frame is at most 1 byte per 254 bytes plus the
+//   delimiter regardless of the data: a 64-byte payload always takes 70 bytes, so
+//   the time it takes to send a frame does not depend on the data.
+
+// Routing table entry of a channel
+typedef struct usart_channel {
+	// Task that owns the channel, it is woken up on channel events
+	uint8_t task;
+	// Buffer of the received payloads, NULL if the channel does not accept data
+	fifo_t* recv_fifo;
+	// Buffer of the payloads to be sent, NULL if the channel has nothing to say
+	fifo_t* send_fifo;
+	// Optional callback that consumes received frames instead of the task
+	usart_sink_t sink;
+	// True if received frames are stored as length-prefixed messages
+	bool messages;
+	// Output is held back until this many bytes are waiting to be sent...
+	uint8_t send_threshold;
+	// ...or until the oldest byte has been waiting for this many milliseconds
+	uint8_t send_delay;
+	// Timer value when the first byte was placed into the empty send buffer
+	uint16_t send_since;
+	// Caller-owned segments of the next zero-copy message, NULL if there is none
+	const usart_segment_t* send_segments;
+	// Total number of bytes in the segments of the next zero-copy message
+	uint8_t send_segment_length;
+	// Number of buffered bytes that were queued before the zero-copy message
+	uint16_t send_before;
+	// Timer value when the last frame was received
+	uint16_t recv_time;
+} usart_channel_t;
+
+// Channel routing table
+usart_channel_t usart_channels[USART_CHANNEL_COUNT];
+
+// Link statistics counters
+usart_stats_t usart_stats;
+
+// Increments a statistics counter, unless it has already reached its maximum
+#define usart_count(counter) do { \
+	if(usart_stats.counter != UINT16_MAX) { \
+		usart_stats.counter++; \
+	} \
+} while(0)
+
+#ifndef USART_COBS
+// Tells whether the byte has to be escaped before sending
+#define usart_needs_escape(data) ((data) == USART_FRAME_BYTE || (data) == USART_ESCAPE_BYTE)
+#endif
 
 #ifndef NO_USART_RECV
 
@@ -87,118 +151,77 @@
 typedef enum {
 	// Some error detected, waiting for the next correct frame boundary
 	INPUT_ERROR,
-	// Normal condition, frame boundary received, waiting for frame header
+	// Normal condition, frame boundary received, waiting for channel byte
 	INPUT_IDLE,
-	// Frame probably starts with an escaped header
-	INPUT_IDLE_ESCAPE,
-	// Frame header received, collecting message body bytes
+	// Channel byte received, waiting for length byte
+	INPUT_LENGTH,
+	// Frame header received, collecting message body bytes and the CRC
 	INPUT_MESSAGE,
-	// Frame header received, collecting message body bytes, the next byte is escaped
-	INPUT_MESSAGE_ESCAPE,
 	// The whole message arrived, the next byte must be a frame boundary
 	INPUT_FRAME_END
 } input_state_t;
 
 // Current receiver state
 input_state_t input_state;
-// Destination task for the currently received bytes
-uint8_t input_task;
+#ifndef USART_COBS
+// True if the previous byte was an escape byte
+bool input_escape;
+#else
+// Number of data bytes still left in the current block
+uint8_t input_block;
+// True if the current block ends with an implied zero byte
+bool input_zero;
+#endif
+// Destination channel for the currently received bytes
+uint8_t input_channel;
 // Number of body bytes still left to be received
 uint8_t input_length;
 // Holds the current CRC value of the message bytes already received
 uint8_t input_crc;
 
-// Received data ready interrupt handler
-ISR(USART_RX_vect) {
-	bool wake = false;
-	bool error = (UCSR0A & ((1 << FE0) | (1 << DOR0) | (1 << UPE0))) != 0;
-	uint8_t data = UDR0;
-
+// Processes the next (unescaped or decoded) byte of the received frame
+static void usart_input(uint8_t data) {
 	switch(input_state) {
-		case INPUT_ERROR:
-			if(!error && data == USART_FRAME_BYTE) {
-				// Go back to normal state only if a proper frame boundary detected
-				input_state = INPUT_IDLE;
-			}
-			break;
 		case INPUT_IDLE:
-			if(error) {
-				input_state = INPUT_ERROR;
-				break;
-			}
-			if(data == USART_FRAME_BYTE) {
-				// Frame bytes can be repeated any time between frames
-				break;
-			}
-			if(data == USART_ESCAPE_BYTE) {
-				// New frame starts immediately with an escape byte
-				input_state = INPUT_IDLE_ESCAPE;
-				break;
-			}
-			// New frame starts normally
-			goto INPUT_HEADER;
-		case INPUT_IDLE_ESCAPE:
-			if(error || data == USART_ESCAPE_BYTE) {
-				// Unexpected escape character or error
-				input_state = INPUT_ERROR;
-				break;
-			}
-			if(data == USART_FRAME_BYTE) {
-				// Unexpected frame boundary, go back to initial state
-				input_state = INPUT_IDLE;
-				break;
-			}
-			// Unescape
-			data ^= USART_ESCAPE_MASK;
 			// New frame starts
-		INPUT_HEADER:
-			input_task = usart_get_message_address(data);
-			if(tasks[input_task].recv_fifo == NULL) {
-				// If the receiver task does not accept data, drop the frame
+			input_channel = data;
+			input_crc = _crc8_ccitt_update(0x00, data);
+			input_state = INPUT_LENGTH;
+			break;
+		case INPUT_LENGTH:
+			if(input_channel >= USART_CHANNEL_COUNT || usart_channels[input_channel].recv_fifo == NULL) {
+				// If nobody accepts data on the channel, drop the frame
+				usart_count(unknown_channel);
 				input_state = INPUT_ERROR;
 				break;
 			}
-			input_length = usart_get_message_length(data);
-			if(!fifo_begin_push(tasks[input_task].recv_fifo, input_length)) {
+			input_length = data;
+			fifo_t* fifo = usart_channels[input_channel].recv_fifo;
+			if(usart_channels[input_channel].messages) {
+				// Store the message length first, and keep the whole message contiguous,
+				// so it can be returned in place (a zero length marks the skipped space,
+				// therefore empty messages are dropped)
+				if(input_length == 0) {
+					usart_count(malformed);
+					input_state = INPUT_ERROR;
+					break;
+				}
+				if(!fifo_begin_push_contiguous(fifo, input_length + 1, 0)) {
+					usart_count(buffer_full);
+					input_state = INPUT_ERROR;
+					break;
+				}
+				fifo_push(fifo, input_length);
+			} else if(!fifo_begin_push(fifo, input_length)) {
 				// If the receiver buffer is full, drop the frame
+				usart_count(buffer_full);
 				input_state = INPUT_ERROR;
 				break;
 			}
-			input_crc = _crc8_ccitt_update(0x00, data);
+			input_crc = _crc8_ccitt_update(input_crc, data);
 			input_state = INPUT_MESSAGE;
 			break;
 		case INPUT_MESSAGE:
-			if(error) {
-				input_state = INPUT_ERROR;
-				break;
-			}
-			if(data == USART_FRAME_BYTE) {
-				// Frame ended prematurely, go back to initial state
-				input_state = INPUT_IDLE;
-				break;
-			}
-			if(data == USART_ESCAPE_BYTE) {
-				// Escape sequence starts
-				input_state = INPUT_MESSAGE_ESCAPE;
-				break;
-			}
-			// Handle received message body byte
-			goto INPUT_BODY;
-		case INPUT_MESSAGE_ESCAPE:
-			if(error || data == USART_ESCAPE_BYTE) {
-				// Unexpected escape character or error
-				input_state = INPUT_ERROR;
-				break;
-			}
-			if(data == USART_FRAME_BYTE) {
-				// Unexpected frame boundary, go back to initial state
-				input_state = INPUT_IDLE;
-				break;
-			}
-			// Unescape
-			data ^= USART_ESCAPE_MASK;
-			// Handle received message body byte
-		INPUT_BODY:
 			input_crc = _crc8_ccitt_update(input_crc, data);
 			if(input_length == 0) {
 				// Message ended, this last byte was the CRC
@@ -206,32 +229,130 @@ ISR(USART_RX_vect) {
 				break;
 			}
 			// Append message
-			fifo_push(tasks[input_task].recv_fifo, data);
+			fifo_push(usart_channels[input_channel].recv_fifo, data);
 			input_length--;
-			input_state = INPUT_MESSAGE;
 			break;
-		case INPUT_FRAME_END:
-			if(error || data != USART_FRAME_BYTE) {
-				// Error or not a frame byte receiver
-				input_state = INPUT_ERROR;
-				break;
-			}
-			if(input_crc == 0x00) {
-				// CRC OK, process the frame
-				fifo_commit_push(tasks[input_task].recv_fifo);
-				// Wake up task if it is waiting for receive
-				if(tasks[input_task].status & TASK_WAIT_RECV) {
-					tasks[input_task].status &= ~TASK_WAITING;
-					wake = true;
-				}
-			}
-			// When we get here, we either stored or dropped the frame, but a new frame starts anyways
-			input_state = INPUT_IDLE;
+		default:
+			// Not a frame byte received after the CRC, or an error occurred
+			usart_count(malformed);
+			input_state = INPUT_ERROR;
 			break;
 	}
+}
+
+// Drops the current frame, if any, because of a malformed byte sequence
+static void usart_input_malformed(void) {
+	if(input_state != INPUT_ERROR) {
+		usart_count(malformed);
+		input_state = INPUT_ERROR;
+	}
+}
+
+// Drops the current frame, if any, because of a hardware receive error
+static void usart_input_error(uint8_t status) {
+	if(status & (1 << DOR0)) {
+		usart_count(overruns);
+	}
+	if(status & ((1 << FE0) | (1 << UPE0))) {
+		usart_count(framing_errors);
+	}
+	input_state = INPUT_ERROR;
+}
+
+// Processes a frame boundary, returns true if a task was woken up
+static bool usart_input_end(void) {
+	bool wake = false;
+	if(input_state == INPUT_FRAME_END && input_crc != 0x00) {
+		usart_count(crc_errors);
+	} else if(input_state == INPUT_LENGTH || input_state == INPUT_MESSAGE) {
+		// Frame ended prematurely
+		usart_count(malformed);
+	} else if(input_state == INPUT_FRAME_END) {
+		// Frame ended properly and CRC OK, process the frame
+		usart_channel_t* channel = &usart_channels[input_channel];
+		fifo_commit_push(channel->recv_fifo);
+		channel->recv_time = timer_get_current_unsafe();
+		usart_count(frames_received);
+		if(channel->sink != NULL) {
+			// Let the sink consume the frame
+			wake = channel->sink(input_channel, channel->recv_fifo);
+		} else if(tasks[channel->task].status & TASK_WAIT_RECV) {
+			// Wake up task if it is waiting for receive
+			tasks[channel->task].status &= ~TASK_WAITING;
+			wake = true;
+		}
+	}
+	// When we get here, we either stored or dropped the frame (if it ended
+	// prematurely), but frame bytes can be repeated any time between frames,
+	// and a new frame starts anyways
+	input_state = INPUT_IDLE;
+	return wake;
+}
+
+// Received data ready interrupt handler
+ISR(USART_RX_vect) {
+	bool wake = false;
+	uint8_t status = UCSR0A;
+	bool error = (status & ((1 << FE0) | (1 << DOR0) | (1 << UPE0))) != 0;
+	uint8_t data = UDR0;
+
+#ifndef USART_COBS
+	if(error) {
+		usart_input_error(status);
+	} else if(data == USART_FRAME_BYTE) {
+		if(input_escape) {
+			// Unexpected frame boundary after an escape byte
+			usart_input_malformed();
+		}
+		wake = usart_input_end();
+		input_escape = false;
+	} else if(input_state == INPUT_ERROR) {
+		// Go back to normal state only if a proper frame boundary detected
+	} else if(data == USART_ESCAPE_BYTE) {
+		if(input_escape) {
+			// Unexpected escape character
+			usart_input_malformed();
+		} else {
+			// Escape sequence starts
+			input_escape = true;
+		}
+	} else {
+		if(input_escape) {
+			// Unescape
+			data ^= USART_ESCAPE_MASK;
+			input_escape = false;
+		}
+		usart_input(data);
+	}
+#else
+	if(error) {
+		usart_input_error(status);
+	} else if(data == USART_FRAME_BYTE) {
+		if(input_block > 0) {
+			// Unexpected frame boundary within a block
+			usart_input_malformed();
+		}
+		// The zero implied by the last block is not part of the frame
+		wake = usart_input_end();
+		input_block = 0;
+		input_zero = false;
+	} else if(input_state == INPUT_ERROR) {
+		// Go back to normal state only if a proper frame boundary detected
+	} else if(input_block == 0) {
+		// Code byte: the previous block ended with an implied zero, unless it was full
+		if(input_zero) {
+			usart_input(0x00);
+		}
+		input_block = data - 1;
+		input_zero = (data != USART_BLOCK_MAX);
+	} else {
+		usart_input(data);
+		input_block--;
+	}
+#endif
 
 	if(wake) {
-		task_schedule_unsafe();
+		task_wake_unsafe();
 	}
 }
 
@@ -248,134 +369,317 @@ ISR(USART_RX_vect) {
 typedef enum {
 	// We are after a frame boundary, ready to send the next message
 	OUTPUT_IDLE,
-	// The message being transmitted starts with an escaped header
-	OUTPUT_IDLE_ESCAPE,
-	// The header of the message has been sent and there are still some body bytes to send
+#ifndef USART_COBS
+	// The frame has been started and there are still some bytes to send
 	OUTPUT_MESSAGE,
-	// The current body byte is escaped
-	OUTPUT_MESSAGE_ESCAPE,
-	// The full message has been sent, only CRC byte is left to send
-	OUTPUT_CRC,
-	// The CRC byte is escaped
-	OUTPUT_CRC_ESCAPE,
-	// The CRC has been sent, a frame boundary has to be sent
+#else
+	// The next byte is a block code byte
+	OUTPUT_CODE,
+	// There are still some data bytes of the current block to send
+	OUTPUT_BLOCK,
+#endif
+	// The whole frame has been sent, a frame boundary has to be sent
 	OUTPUT_FRAME_END
 } output_state_t;
 
+// Position within the frame being sent
+typedef struct output_cursor {
+	// Index of the next byte: channel, length, payload bytes, then the CRC
+	uint16_t index;
+	// Current segment of a zero-copy message
+	const usart_segment_t* segment;
+	// Index of the next byte within the current segment
+	uint8_t offset;
+	// Holds the current CRC value of the frame bytes already read
+	uint8_t crc;
+} output_cursor_t;
+
 // Current transmitter state
 output_state_t output_state;
-// Task buffer for the currently sent bytes
-uint8_t output_task;
-// Number of body bytes still left to be sent
+// Channel of the currently sent bytes
+uint8_t output_channel;
+// Number of body bytes of the current frame
 uint8_t output_length;
-// Holds the current CRC value of the message bytes already processed
-uint8_t output_crc;
+// True if the current frame is a zero-copy message, false if it is from the FIFO
+bool output_zero_copy;
+// Position of the next byte to be sent
+output_cursor_t output_cursor;
+#ifndef USART_COBS
+// True if an escape byte was sent, and the escaped data byte comes next
+bool output_escape;
+// The last data byte of the frame that has been processed
+uint8_t output_data;
+#else
+// Position of the next byte to be looked at when looking for zero bytes
+output_cursor_t output_scan;
+// Number of data bytes of the next block found so far
+uint8_t output_scan_count;
+// True if the next block ends with an implied zero byte
+bool output_scan_zero;
+// True if the end of the next block has been found
+bool output_scan_done;
+// Number of data bytes still left in the current block
+uint8_t output_block;
+// True if the current block ends with an implied zero byte
+bool output_zero;
+#endif
+// True if some output is held back for coalescing, and transmission is off
+bool output_pending;
+
+// Tells whether a frame is being read, and it has some bytes still to send
+#ifndef USART_COBS
+#define usart_output_busy() (output_state == OUTPUT_MESSAGE)
+#else
+#define usart_output_busy() (output_state == OUTPUT_CODE || output_state == OUTPUT_BLOCK)
+#endif
+
+// Total number of bytes in the current frame
+#define usart_output_size() ((uint16_t)output_length + 3)
+
+// Tells whether the channel has enough or old enough output to be framed
+static bool usart_output_due(usart_channel_t* channel) {
+	if(channel->send_segments != NULL) {
+		// Zero-copy messages are framed as they are, after the output buffered before them
+		return true;
+	}
+	fifo_t* fifo = channel->send_fifo;
+	if(fifo == NULL || fifo_size(fifo) == 0) {
+		return false;
+	}
+	if(fifo_size(fifo) >= channel->send_threshold) {
+		return true;
+	}
+	if(timer_has_elapsed_unsafe(channel->send_since, channel->send_delay)) {
+		return true;
+	}
+	// Some output is there, but it is still worth waiting for more
+	output_pending = true;
+	return false;
+}
+
+// Looks for a channel that has data to send, in round-robin order starting
+// after the channel that has been served the last time, and starts a new frame
+static bool usart_output_begin(void) {
+	output_pending = false;
+	for(uint8_t i = 0; i < USART_CHANNEL_COUNT; ++i) {
+		if(++output_channel >= USART_CHANNEL_COUNT) {
+			output_channel = 0;
+		}
+		usart_channel_t* channel = &usart_channels[output_channel];
+		if(usart_output_due(channel)) {
+			output_zero_copy = (channel->send_segments != NULL && channel->send_before == 0);
+			if(output_zero_copy) {
+				// Zero-copy message, body bytes are read directly from the segments
+				output_length = channel->send_segment_length;
+			} else {
+				// Only the output buffered before a zero-copy message goes ahead of it
+				uint16_t size = (channel->send_segments != NULL) ? channel->send_before : fifo_size(channel->send_fifo);
+				output_length = size > USART_LENGTH_MAX ? USART_LENGTH_MAX : size;
+			}
+			output_cursor.index = 0;
+			output_cursor.segment = channel->send_segments;
+			output_cursor.offset = 0;
+			output_cursor.crc = 0x00;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns the next byte of the current frame, and advances the cursor
+static uint8_t usart_output_next(output_cursor_t* cursor) {
+	uint16_t index = cursor->index++;
+	uint8_t data;
+	if(index == 0) {
+		data = output_channel;
+	} else if(index == 1) {
+		data = output_length;
+	} else if(index < usart_output_size() - 1) {
+		if(output_zero_copy) {
+			// Skip exhausted (or empty) segments
+			while(cursor->offset >= cursor->segment->length) {
+				cursor->segment++;
+				cursor->offset = 0;
+			}
+			data = cursor->segment->data[cursor->offset++];
+		} else {
+			data = fifo_peek_at(usart_channels[output_channel].send_fifo, index - 2);
+		}
+	} else {
+		// Footer
+		return cursor->crc;
+	}
+	cursor->crc = _crc8_ccitt_update(cursor->crc, data);
+	return data;
+}
+
+#ifdef USART_COBS
+// Starts looking for the end of the next block at the scan position
+static void usart_output_scan_begin(void) {
+	output_scan_count = 0;
+	output_scan_zero = false;
+	output_scan_done = false;
+}
+
+// Looks ahead for the next zero byte, at most a full block away, but only a
+// few bytes at a time, returns true if the end of the next block was found
+static bool usart_output_scan(void) {
+	for(uint8_t i = 0; i < USART_SCAN_STEP && !output_scan_done; ++i) {
+		if(output_scan_count >= USART_BLOCK_MAX - 1 || output_scan.index >= usart_output_size()) {
+			output_scan_done = true;
+		} else if(usart_output_next(&output_scan) == 0x00) {
+			output_scan_zero = true;
+			output_scan_done = true;
+		} else {
+			output_scan_count++;
+		}
+	}
+	return output_scan_done;
+}
+#endif
+
+// Frees the output of the current frame, returns true if a task was woken up
+static bool usart_output_end(void) {
+	usart_channel_t* channel = &usart_channels[output_channel];
+	// Message is sent, free the buffer or give back the segments
+	if(output_zero_copy) {
+		channel->send_segments = NULL;
+	} else {
+		fifo_skip(channel->send_fifo, output_length);
+		channel->send_before = (channel->send_before > output_length) ? channel->send_before - output_length : 0;
+	}
+	usart_count(frames_sent);
+	// Wake up task if it is waiting to send
+	if(tasks[channel->task].status & TASK_WAIT_SEND) {
+		tasks[channel->task].status &= ~TASK_WAITING;
+		return true;
+	}
+	return false;
+}
 
 // Ready to send data interrupt handler
 ISR(USART_UDRE_vect) {
 	bool wake = false;
-	uint8_t data;
+
+#ifndef USART_COBS
+	if(output_escape) {
+		// Send the escaped data byte, the state has already been advanced
+		UDR0 = output_data ^ USART_ESCAPE_MASK;
+		output_escape = false;
+		return;
+	}
+
 	switch(output_state) {
 		case OUTPUT_IDLE:
-			// Look for a task that has data to send
-			for(output_task = 0; output_task < TASK_COUNT; ++output_task) {
-				if(tasks[output_task].send_fifo != NULL && tasks[output_task].send_fifo->size > 0) {
-					break;
-				}
-			}
-			if(output_task >= TASK_COUNT) {
+			if(!usart_output_begin()) {
 				// We have nothing to send, turn off transmission
+				// If some output is held back, the timer will turn it on again
 				usart_send_off();
-				break;
+				return;
 			}
+			output_state = OUTPUT_MESSAGE;
+			// Fall through
+		case OUTPUT_MESSAGE:
+			// Send next frame byte
+			output_data = usart_output_next(&output_cursor);
+			if(output_cursor.index >= usart_output_size()) {
+				// Whole frame was read, a frame boundary comes next
+				wake = usart_output_end();
+				output_state = OUTPUT_FRAME_END;
+			}
+			break;
+		case OUTPUT_FRAME_END:
+			// Send closing frame byte, it is never escaped
+			UDR0 = USART_FRAME_BYTE;
+			output_state = OUTPUT_IDLE;
+			return;
+	}
 
-			// Start sending the header
-			output_length = tasks[output_task].send_fifo->size & USART_LENGTH_MAX;
-			fifo_begin_pop(tasks[output_task].send_fifo, output_length);
-			data = usart_get_message_header(output_task, output_length);
-			output_crc = _crc8_ccitt_update(0x00, data);
-
-			if(data == USART_FRAME_BYTE || data == USART_ESCAPE_BYTE) {
-				// Header should be escaped, send escape byte first
-				UDR0 = USART_ESCAPE_BYTE;
-				output_state = OUTPUT_IDLE_ESCAPE;
-				break;
+	if(usart_needs_escape(output_data)) {
+		// Data byte should be escaped, send escape byte first
+		UDR0 = USART_ESCAPE_BYTE;
+		output_escape = true;
+	} else {
+		UDR0 = output_data;
+	}
+#else
+	switch(output_state) {
+		case OUTPUT_IDLE:
+			if(!usart_output_begin()) {
+				// We have nothing to send, turn off transmission
+				// If some output is held back, the timer will turn it on again
+				usart_send_off();
+				return;
 			}
-			// Send header byte
-			goto OUTPUT_HEADER;
-		case OUTPUT_IDLE_ESCAPE:
-			// Send the escaped data
-			data = usart_get_message_header(output_task, output_length) ^ USART_ESCAPE_MASK;
-		OUTPUT_HEADER:
-			UDR0 = data;
-			if(output_length == 0) {
-				// Message without body, CRC comes next
-				output_state = OUTPUT_CRC;
-			} else {
-				output_state = OUTPUT_MESSAGE;
+			output_scan = output_cursor;
+			usart_output_scan_begin();
+			output_state = OUTPUT_CODE;
+			// Fall through
+		case OUTPUT_CODE:
+			if(!usart_output_scan()) {
+				// The end of the block is not found yet, the interrupt fires
+				// again right away, but the pending interrupts of higher
+				// priority are served in between
+				return;
 			}
-			break;
-		case OUTPUT_MESSAGE:
-			// Send next message body byte
-			data = fifo_peek(tasks[output_task].send_fifo);
-			output_crc = _crc8_ccitt_update(output_crc, data);
-			if(data == USART_FRAME_BYTE || data == USART_ESCAPE_BYTE) {
-				// Body byte should be escaped, send espace byte first
-				UDR0 = USART_ESCAPE_BYTE;
-				output_state = OUTPUT_MESSAGE_ESCAPE;
+			// Send code byte
+			UDR0 = output_scan_count + 1;
+			output_block = output_scan_count;
+			output_zero = output_scan_zero;
+			usart_output_scan_begin();
+			if(output_block > 0) {
+				output_state = OUTPUT_BLOCK;
 				break;
 			}
-			fifo_pop(tasks[output_task].send_fifo);
-			goto OUTPUT_BODY;
-		case OUTPUT_MESSAGE_ESCAPE:
-			// Send escaped data byte
-			data = fifo_pop(tasks[output_task].send_fifo) ^ USART_ESCAPE_MASK;
-		OUTPUT_BODY:
-			UDR0 = data;
-			if(--output_length == 0) {
-				// Whole message was sent, CRC comes next
-				output_state = OUTPUT_CRC;
-			} else {
-				output_state = OUTPUT_MESSAGE;
-			}
-			break;
-		case OUTPUT_CRC:
-			data = output_crc;
-			if(data == USART_FRAME_BYTE || data == USART_ESCAPE_BYTE) {
-				// CRC byte should be escaped, send espace byte first
-				UDR0 = USART_ESCAPE_BYTE;
-				output_state = OUTPUT_CRC_ESCAPE;
+			goto OUTPUT_BLOCK_END;
+		case OUTPUT_BLOCK:
+			// Send next data byte of the block, and look for the end of the
+			// next one meanwhile
+			UDR0 = usart_output_next(&output_cursor);
+			usart_output_scan();
+			if(--output_block > 0) {
 				break;
 			}
-			// Send CRC byte
-			goto OUTPUT_FOOTER;
-		case OUTPUT_CRC_ESCAPE:
-			// Send escaped CRC byte
-			data = output_crc ^ USART_ESCAPE_MASK;
-		OUTPUT_FOOTER:
-			UDR0 = data;
-			// Message is sent, free the buffer
-			fifo_commit_pop(tasks[output_task].send_fifo);
-			// Wake up task if it is waiting to send
-			if(tasks[output_task].status & TASK_WAIT_SEND) {
-				tasks[output_task].status &= ~TASK_WAITING;
-				wake = true;
+		OUTPUT_BLOCK_END:
+			if(output_zero) {
+				// Skip the zero byte, it is implied by the code byte, another block follows
+				usart_output_next(&output_cursor);
+				output_state = OUTPUT_CODE;
+			} else if(output_cursor.index < usart_output_size()) {
+				// Full block, another block follows
+				output_state = OUTPUT_CODE;
+			} else {
+				// Whole frame was sent, a frame boundary comes next
+				wake = usart_output_end();
+				output_state = OUTPUT_FRAME_END;
 			}
-			output_state = OUTPUT_FRAME_END;
 			break;
 		case OUTPUT_FRAME_END:
 			// Send closing frame byte
 			UDR0 = USART_FRAME_BYTE;
 			output_state = OUTPUT_IDLE;
-			break;
+			return;
 	}
+#endif
 
 	// Handle possible task switch
 	if(wake) {
-		task_schedule_unsafe();
+		task_wake_unsafe();
+	}
+}
+
+void usart_tick(void) {
+	if(output_pending) {
+		// Let the transmitter reevaluate the held back output
+		output_pending = false;
+		usart_send_on();
 	}
 }
 
+bool usart_is_sending_unsafe(void) {
+	return output_pending || (UCSR0B & (1 << UDRIE0)) || !(UCSR0A & (1 << UDRE0));
+}
+
 #endif // NO_USART_SEND
 
 void usart_init(void) {
@@ -389,14 +693,24 @@ void usart_init(void) {
 
 #ifndef NO_USART_SEND
 	output_state = OUTPUT_FRAME_END;
-	output_task = TASK_COUNT;
+#ifndef USART_COBS
+	output_escape = false;
+#endif
+	output_channel = 0;
 	output_length = 0;
+	output_pending = false;
 #endif
 
 #ifndef NO_USART_RECV
 	// Init state machines
 	input_state = INPUT_ERROR;
-	input_task = TASK_COUNT;
+#ifndef USART_COBS
+	input_escape = false;
+#else
+	input_block = 0;
+	input_zero = false;
+#endif
+	input_channel = 0;
 	input_length = 0;
 
 	// Enable receive via interrupts
@@ -416,65 +730,282 @@ void usart_stop(void) {
 	}
 }
 
+void usart_route(uint8_t channel, uint8_t task, fifo_t* recv_fifo, fifo_t* send_fifo) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		usart_channels[channel].task = task;
+		usart_channels[channel].recv_fifo = recv_fifo;
+		usart_channels[channel].send_fifo = send_fifo;
+		usart_channels[channel].sink = NULL;
+		usart_channels[channel].messages = false;
+		usart_channels[channel].send_threshold = 0;
+		usart_channels[channel].send_delay = 0;
+		usart_channels[channel].send_segments = NULL;
+		usart_channels[channel].send_before = 0;
+	}
+}
+
+void usart_set_sink(uint8_t channel, usart_sink_t sink) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		usart_channels[channel].sink = sink;
+	}
+}
+
+void usart_get_stats(usart_stats_t* stats, bool reset) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*stats = usart_stats;
+		if(reset) {
+			memset(&usart_stats, 0, sizeof(usart_stats));
+			for(uint8_t i = 0; i < USART_CHANNEL_COUNT; ++i) {
+				if(usart_channels[i].recv_fifo != NULL) {
+					fifo_reset_peak(usart_channels[i].recv_fifo);
+				}
+				if(usart_channels[i].send_fifo != NULL) {
+					fifo_reset_peak(usart_channels[i].send_fifo);
+				}
+			}
+		}
+	}
+}
+
+void usart_get_peaks(uint8_t channel, uint16_t* recv_peak, uint16_t* send_peak) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		fifo_t* recv_fifo = usart_channels[channel].recv_fifo;
+		fifo_t* send_fifo = usart_channels[channel].send_fifo;
+		*recv_peak = (recv_fifo != NULL) ? fifo_peak(recv_fifo) : 0;
+		*send_peak = (send_fifo != NULL) ? fifo_peak(send_fifo) : 0;
+	}
+}
+
+void usart_reset(uint8_t channel) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		usart_channel_t* ch = &usart_channels[channel];
+#ifndef NO_USART_RECV
+		if(input_channel == channel && input_state != INPUT_IDLE) {
+			// Drop the frame being received, its bytes are not committed yet
+			input_state = INPUT_ERROR;
+		}
+		if(ch->recv_fifo != NULL) {
+			fifo_clear(ch->recv_fifo);
+		}
+#endif
+#ifndef NO_USART_SEND
+		if(output_channel == channel && usart_output_busy()) {
+			// Abort the frame being sent by closing it prematurely, so the remote
+			// side drops it, and its data is not read anymore
+			output_state = OUTPUT_FRAME_END;
+#ifndef USART_COBS
+			output_escape = false;
+#endif
+		}
+		if(ch->send_fifo != NULL) {
+			fifo_clear(ch->send_fifo);
+		}
+		ch->send_segments = NULL;
+		ch->send_before = 0;
+#endif
+	}
+}
+
+void usart_reset_task(uint8_t task) {
+	for(uint8_t channel = 0; channel < USART_CHANNEL_COUNT; ++channel) {
+		if(usart_channels[channel].task == task) {
+			usart_reset(channel);
+		}
+	}
+}
+
+#ifndef NO_USART_RECV
+void usart_set_message_mode(uint8_t channel, bool enabled) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		usart_channels[channel].messages = enabled;
+		fifo_clear(usart_channels[channel].recv_fifo);
+	}
+}
+#endif
+
+#ifndef NO_USART_SEND
+void usart_set_coalescing(uint8_t channel, uint8_t threshold, uint8_t delay_ms) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		usart_channels[channel].send_threshold = threshold;
+		usart_channels[channel].send_delay = delay_ms;
+	}
+}
+#endif
+
 #ifndef NO_USART_RECV
-bool usart_receive_bytes(uint8_t* dest, size_t count, uint16_t wait_ms) {
+// Sets up the wait status of the current task for a receive-related event
+static void usart_wait_recv_unsafe(task_t* task, uint16_t start, uint16_t wait_ms) {
+	// Set up task wait status
+	task->status |= TASK_WAIT_RECV;
+	if(wait_ms != TIMER_INFINITE) {
+		// Set up a timeout as well
+		task->status |= TASK_WAIT_TIMER;
+		task->wait_until = start + wait_ms;
+	}
+
+	// Yield execution -> this will return only when either some more bytes
+	// were received or the timeout was reached
+	task_schedule_unsafe();
+}
+
+bool usart_receive_bytes(uint8_t channel, uint8_t* dest, size_t count, uint16_t wait_ms) {
 	bool ret = false;
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
 		task_t* task = task_current_unsafe();
+		fifo_t* fifo = usart_channels[channel].recv_fifo;
 		uint16_t start = timer_get_current_unsafe();
 		// If there's not enough data in the buffer and we're allowed to then we wait
 		// for some more bytes to arrive
-		while(fifo_size(task->recv_fifo) < count && !timer_has_elapsed_unsafe(start, wait_ms)) {
-			// Set up task wait status
-			task->status |= TASK_WAIT_RECV;
-			if(wait_ms != TIMER_INFINITE) {
-				// Set up a timeout as well
-				task->status |= TASK_WAIT_TIMER;
-				task->wait_until = start + wait_ms;
-			}
-
-			// Yield execution -> this will return only when either some more bytes
-			// were received or the timeout was reached
-			task_schedule_unsafe();
+		while(fifo_size(fifo) < count && !timer_has_elapsed_unsafe(start, wait_ms)) {
+			usart_wait_recv_unsafe(task, start, wait_ms);
 		}
 
 		// If enough bytes are available, copy to output buffer
-		ret = fifo_pop_bytes(task->recv_fifo, dest, count);
+		ret = fifo_pop_bytes(fifo, dest, count);
 	}
 	return ret;
 }
+
+const uint8_t* usart_receive_message(uint8_t channel, uint8_t* length, uint16_t wait_ms) {
+	uint8_t* message = NULL;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		task_t* task = task_current_unsafe();
+		fifo_t* fifo = usart_channels[channel].recv_fifo;
+		uint16_t start = timer_get_current_unsafe();
+		// Messages are committed as a whole, so any data means a whole message
+		while(fifo_size(fifo) == 0 && !timer_has_elapsed_unsafe(start, wait_ms)) {
+			usart_wait_recv_unsafe(task, start, wait_ms);
+		}
+
+		size_t span = fifo_peek_span(fifo, &message);
+		if(span > 0 && message[0] == 0) {
+			// Skip the unused space at the end of the buffer, the message follows
+			// at the beginning
+			fifo_skip(fifo, span);
+			span = fifo_peek_span(fifo, &message);
+		}
+		if(span > 0) {
+			*length = message[0];
+			message++;
+		} else {
+			message = NULL;
+		}
+	}
+	return message;
+}
+
+void usart_release_message(uint8_t channel) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		fifo_t* fifo = usart_channels[channel].recv_fifo;
+		uint8_t* message;
+		if(fifo_peek_span(fifo, &message) > 0) {
+			fifo_skip(fifo, message[0] + 1);
+		}
+	}
+}
+
+uint16_t usart_get_receive_time(uint8_t channel) {
+	uint16_t time;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		time = usart_channels[channel].recv_time;
+	}
+	return time;
+}
 #endif
 
 #ifndef NO_USART_SEND
-bool usart_send_bytes(const uint8_t* src, size_t count, uint16_t wait_ms) {
+// Sets up the wait status of the current task for a send-related event
+static void usart_wait_send_unsafe(task_t* task, uint16_t start, uint16_t wait_ms) {
+	// Set up task wait status
+	task->status |= TASK_WAIT_SEND;
+	if(wait_ms != TIMER_INFINITE) {
+		// Set up a timeout as well
+		task->status |= TASK_WAIT_TIMER;
+		task->wait_until = start + wait_ms;
+	}
+
+	// Yield execution -> this will return only when either a message
+	// was sent or the timeout was reached
+	task_schedule_unsafe();
+}
+
+bool usart_send_bytes(uint8_t channel, const uint8_t* src, size_t count, uint16_t wait_ms) {
 	bool ret = false;
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
 		task_t* task = task_current_unsafe();
+		fifo_t* fifo = usart_channels[channel].send_fifo;
 		uint16_t start = timer_get_current_unsafe();
 		// If there's not enough free space in the buffer and we're allowed to then
 		// we wait for some bytes to leave from the buffer
-		while(fifo_available(task->send_fifo) < count && !timer_has_elapsed_unsafe(start, wait_ms)) {
-			// Set up task wait status
-			task->status |= TASK_WAIT_SEND;
-			if(wait_ms != TIMER_INFINITE) {
-				// Set up a timeout as well
-				task->status |= TASK_WAIT_TIMER;
-				task->wait_until = start + wait_ms;
-			}
-
-			// Yield execution -> this will return only when either some more bytes
-			// were sent or the timeout was reached
-			task_schedule_unsafe();
+		while(fifo_available(fifo) < count && !timer_has_elapsed_unsafe(start, wait_ms)) {
+			usart_wait_send_unsafe(task, start, wait_ms);
 		}
 
 		// If enough space is available, copy from input buffer
-		ret = fifo_push_bytes(task->send_fifo, src, count);
+		ret = usart_post_unsafe(channel, src, count);
+	}
+	return ret;
+}
+
+bool usart_post_unsafe(uint8_t channel, const uint8_t* src, size_t count) {
+	fifo_t* fifo = usart_channels[channel].send_fifo;
+	if(fifo_size(fifo) == 0) {
+		usart_channels[channel].send_since = timer_get_current_unsafe();
+	}
+	if(!fifo_push_bytes(fifo, src, count)) {
+		return false;
+	}
+	usart_send_on();
+	return true;
+}
+
+bool usart_send_segments(uint8_t channel, const usart_segment_t* segments, uint8_t count, uint16_t wait_ms) {
+	// The whole message should fit into a single frame
+	uint16_t length = 0;
+	for(uint8_t i = 0; i < count; ++i) {
+		length += segments[i].length;
+	}
+	if(length == 0 || length > USART_LENGTH_MAX) {
+		return false;
+	}
+
+	bool ret = false;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		task_t* task = task_current_unsafe();
+		usart_channel_t* ch = &usart_channels[channel];
+		uint16_t start = timer_get_current_unsafe();
+		// If a previous zero-copy message is still being sent and we're allowed
+		// to then we wait for it to complete
+		while(ch->send_segments != NULL && !timer_has_elapsed_unsafe(start, wait_ms)) {
+			usart_wait_send_unsafe(task, start, wait_ms);
+		}
+
+		// If the channel is free, queue the descriptor
+		ret = (ch->send_segments == NULL);
 		if(ret) {
+			ch->send_segments = segments;
+			ch->send_segment_length = length;
+			// The output already buffered on the channel is sent first
+			ch->send_before = (ch->send_fifo != NULL) ? fifo_size(ch->send_fifo) : 0;
 			usart_send_on();
 		}
 	}
 	return ret;
 }
+
+bool usart_wait_sent(uint8_t channel, uint16_t wait_ms) {
+	bool ret = false;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		task_t* task = task_current_unsafe();
+		usart_channel_t* ch = &usart_channels[channel];
+		uint16_t start = timer_get_current_unsafe();
+		while(ch->send_segments != NULL && !timer_has_elapsed_unsafe(start, wait_ms)) {
+			usart_wait_send_unsafe(task, start, wait_ms);
+		}
+		ret = (ch->send_segments == NULL);
+	}
+	return ret;
+}
 #endif
 
 #endif // NO_USART
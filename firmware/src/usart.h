@@ -1,8 +1,8 @@
 /**
  * @file usart.h
  * Buffered USART communication library.
- * It supports simple HDLC-like framing with CRC-8 error detection, no-copy
- * operation for both input and output messages.
+ * It supports simple HDLC-like or COBS framing with CRC-8 error detection,
+ * no-copy operation for both input and output messages.
  *
  * @copyright (C) 2017 Peter Budai
  */
@@ -16,6 +16,65 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "fifo.h"
+
+/**
+ * Number of entries in the channel routing table.
+ * Each frame carries a whole channel byte, so the wire format could address
+ * up to 256 channels, but only the first this many can be routed.
+ */
+#define USART_CHANNEL_COUNT 4
+
+/// Channel that carries the traffic of the system task.
+#define USART_CHANNEL_SYSTEM 0
+/// Channel that carries the traffic of the running application.
+#define USART_CHANNEL_APP 1
+/// Channel that carries event reports of the system to the remote host.
+#define USART_CHANNEL_EVENT 2
+
+/**
+ * Receive sink callback prototype.
+ * It is called from the receive interrupt handler, right after a complete and
+ * error-free frame was appended to the receive FIFO of the channel, instead of
+ * waking up the owner task. Keep it short, interrupts are disabled.
+ *
+ * @param channel Channel number the frame was addressed to.
+ * @param fifo Receive FIFO of the channel that holds the new payload.
+ * @return True if the sink woke up a task, so rescheduling is needed.
+ */
+typedef bool (*usart_sink_t)(uint8_t channel, fifo_t* fifo);
+
+/**
+ * Link statistics.
+ * Each counter saturates at its maximum value instead of wrapping around.
+ */
+typedef struct usart_stats {
+	/// Frames received without error and stored in a receive buffer.
+	uint16_t frames_received;
+	/// Frames sent.
+	uint16_t frames_sent;
+	/// Bytes received with a framing (missing stop bit) or parity error.
+	uint16_t framing_errors;
+	/// Bytes lost because the previous one was not read in time (data overrun).
+	uint16_t overruns;
+	/// Frames dropped because their CRC did not match.
+	uint16_t crc_errors;
+	/// Frames dropped because the receive buffer of their channel was full.
+	uint16_t buffer_full;
+	/// Frames dropped because their channel was unknown or not routed.
+	uint16_t unknown_channel;
+	/// Frames dropped because of broken byte stuffing or length mismatch.
+	uint16_t malformed;
+} usart_stats_t;
+
+/// Segment of a zero-copy output message.
+typedef struct usart_segment {
+	/// Caller-owned data of the segment.
+	const uint8_t* data;
+	/// Number of bytes in the segment.
+	uint8_t length;
+} usart_segment_t;
+
 /**
  * Initialize USART for transmit and receive.
  * Baud rate will be 38400 and frame format is 8N1.
@@ -25,12 +84,87 @@ void usart_init(void);
 /// Stops USART reception and transmission.
 void usart_stop(void);
 
+/**
+ * Sets up a routing table entry, so frames addressed to the channel are
+ * appended to recv_fifo, and the contents of send_fifo are sent on the channel.
+ * The given task is woken up when data arrives or leaves.
+ * It should be called before usart_init(), or for an idle channel only.
+ *
+ * @param channel Channel number, less than @ref USART_CHANNEL_COUNT.
+ * @param task Task slot identifier that owns the channel.
+ * @param recv_fifo Receive buffer, or NULL to drop all incoming frames.
+ * @param send_fifo Send buffer, or NULL if the channel is receive-only.
+ */
+void usart_route(uint8_t channel, uint8_t task, fifo_t* recv_fifo, fifo_t* send_fifo);
+
+/**
+ * Attaches a receive sink callback to an already routed channel.
+ *
+ * @param channel Channel number, less than @ref USART_CHANNEL_COUNT.
+ * @param sink Callback to call on each received frame, or NULL to wake up the
+ *     owner task instead.
+ */
+void usart_set_sink(uint8_t channel, usart_sink_t sink);
+
+/**
+ * Returns the link statistics.
+ *
+ * @param stats Set to the current values of the counters.
+ * @param reset True to reset the counters and the buffer high-water marks
+ *     after reading them.
+ */
+void usart_get_stats(usart_stats_t* stats, bool reset);
+
+/**
+ * Returns the high-water marks of the buffers of a channel, which show the
+ * most bytes they have held since they were initialized or reset.
+ *
+ * @param channel Channel number, less than @ref USART_CHANNEL_COUNT.
+ * @param recv_peak Set to the high-water mark of the receive buffer, 0 if there is none.
+ * @param send_peak Set to the high-water mark of the send buffer, 0 if there is none.
+ */
+void usart_get_peaks(uint8_t channel, uint16_t* recv_peak, uint16_t* send_peak);
+
+/**
+ * Drops all buffered data of a channel, in both directions, eg. when the task
+ * that owns the channel is restarted. The frames being received or sent on the
+ * channel are aborted as well, so the buffers and the segments of zero-copy
+ * messages are not accessed anymore, and the buffers can be reinitialized.
+ * The routing, the receive mode and the coalescing settings are kept.
+ *
+ * @param channel Channel number, less than @ref USART_CHANNEL_COUNT.
+ */
+void usart_reset(uint8_t channel);
+
+/**
+ * Drops all buffered data of the channels routed to a task, see usart_reset().
+ *
+ * @param task Task slot identifier.
+ */
+void usart_reset_task(uint8_t task);
+
+#ifndef NO_USART_RECV
+/**
+ * Switches the receive buffer of a channel between stream and message mode.
+ * In stream mode, the payloads of the received frames are concatenated into a
+ * byte stream, use usart_receive_bytes() to read it. In message mode, frame
+ * boundaries are preserved: each payload is stored as a length-prefixed message,
+ * contiguously, use usart_receive_message() to read them. The channel must
+ * already be routed, and its receive buffer is cleared when the mode changes.
+ *
+ * @param channel Channel number, less than @ref USART_CHANNEL_COUNT.
+ * @param enabled True to switch to message mode, false for stream mode.
+ */
+void usart_set_message_mode(uint8_t channel, bool enabled);
+#endif
+
 #ifndef NO_USART_RECV
 /**
  * Returns or waits for the next count number of received bytes from the
  * input queue. If there is not enough received bytes available, it waits for
  * at most the given period of time for them to arrive.
  *
+ * @param channel Channel to receive from, it should be owned by the current task.
  * @param wait_ms Maximum number of milliseconds to wait for a message to arrive.
  *     Value of 0 will make this function non-blocking.
  *     Value of @ref TIMER_INFINITE will make the the function block indefinitely
@@ -38,15 +172,77 @@ void usart_stop(void);
  * @return True if count bytes were successfully copied into buffer.
  *     False if less than count bytes were available until wait_ms elapsed.
  */
-bool usart_receive_bytes(uint8_t* dest, size_t count, uint16_t wait_ms);
+bool usart_receive_bytes(uint8_t channel, uint8_t* dest, size_t count, uint16_t wait_ms);
+
+/**
+ * Returns or waits for the next whole message received on a message mode
+ * channel. The message is returned in place, it stays in the input queue
+ * until usart_release_message() is called.
+ *
+ * @param channel Channel to receive from, it should be owned by the current task.
+ * @param length Set to the length of the message, which is at least 1.
+ * @param wait_ms Maximum number of milliseconds to wait for a message to arrive.
+ *     Value of 0 will make this function non-blocking.
+ *     Value of @ref TIMER_INFINITE will make the the function block indefinitely
+ *     until a message arrives.
+ * @return Address of the message payload in the input queue.
+ *     NULL if no message arrived until wait_ms elapsed.
+ */
+const uint8_t* usart_receive_message(uint8_t channel, uint8_t* length, uint16_t wait_ms);
+
+/**
+ * Removes the message returned by usart_receive_message() from the input queue,
+ * so its space can be reused.
+ *
+ * @param channel Channel that the message was received from.
+ */
+void usart_release_message(uint8_t channel);
+
+/**
+ * Returns the timer value when the last frame was received on the channel.
+ * It is taken as the frame ends, so it does not depend on when the receiving
+ * task gets to run.
+ *
+ * @param channel Channel number, less than @ref USART_CHANNEL_COUNT.
+ */
+uint16_t usart_get_receive_time(uint8_t channel);
 #endif
 
 #ifndef NO_USART_SEND
+/**
+ * Sets up output coalescing for a channel.
+ * Bytes placed into the output queue of the channel are not framed until at
+ * least threshold bytes are waiting, or the oldest of them has been waiting
+ * for delay_ms, so each frame carries a useful payload. Channels that have
+ * output due are served in round-robin order. Coalescing is off by default.
+ *
+ * @param channel Channel number, less than @ref USART_CHANNEL_COUNT.
+ * @param threshold Number of bytes that is worth a frame, 0 or 1 disables coalescing.
+ * @param delay_ms Maximum number of milliseconds to hold back output.
+ */
+void usart_set_coalescing(uint8_t channel, uint8_t threshold, uint8_t delay_ms);
+
+/**
+ * Timer interrupt handler that restarts transmission when held back output
+ * may have become due.
+ * This will be called by the timer once in every milliseconds.
+ */
+void usart_tick(void);
+
+/**
+ * Tells whether the transmitter has any output to send, including the output
+ * held back for coalescing. Interrupts must be disabled when calling it.
+ *
+ * @return True if the transmitter should keep running.
+ */
+bool usart_is_sending_unsafe(void);
+
 /**
  * Sends or waits for the next count number of bytes to be placed into the
  * output queue. If the output queue is full, it waits for at most the given
  * period of time for enough space to become available.
  *
+ * @param channel Channel to send on, it should be owned by the current task.
  * @param wait_ms Maximum number of milliseconds to wait for a message to be sent.
  *     Value of 0 will make this function non-blocking.
  *     Value of @ref TIMER_INFINITE will make the the function block indefinitely
@@ -54,7 +250,53 @@ bool usart_receive_bytes(uint8_t* dest, size_t count, uint16_t wait_ms);
  * @return True if count bytes were successfully placed in the output queue.
  *     False if less than count bytes of space were available until wait_ms elapsed.
  */
-bool usart_send_bytes(const uint8_t* src, size_t count, uint16_t wait_ms);
+bool usart_send_bytes(uint8_t channel, const uint8_t* src, size_t count, uint16_t wait_ms);
+
+/**
+ * Places count number of bytes into the output queue without waiting, so it
+ * can be called from interrupt handlers, eg. to report events.
+ * Interrupts must be disabled when calling it.
+ *
+ * @param channel Channel to send on.
+ * @return True if count bytes were placed in the output queue.
+ *     False if there was not enough space.
+ */
+bool usart_post_unsafe(uint8_t channel, const uint8_t* src, size_t count);
+
+/**
+ * Queues a zero-copy message that is gathered from the given segments and sent
+ * as a single frame. The transmitter reads the segment list and the segment data
+ * directly, so neither of them can be modified or freed until the message has
+ * been sent, see usart_wait_sent(). Only one zero-copy message can be queued
+ * per channel. If another one is still being sent, it waits for at most the
+ * given period of time for that to complete. The output already buffered on
+ * the channel is sent before the message, regardless of the coalescing
+ * settings, and the output buffered after it is sent after it.
+ *
+ * @param channel Channel to send on, it should be owned by the current task.
+ * @param segments Array of segments, the total length must be between 1 and 255.
+ * @param count Number of segments in the array.
+ * @param wait_ms Maximum number of milliseconds to wait for the channel to be free.
+ *     Value of 0 will make this function non-blocking.
+ *     Value of @ref TIMER_INFINITE will make the the function block indefinitely
+ *     until the previous message is sent.
+ * @return True if the message was queued.
+ *     False if the channel was busy until wait_ms elapsed, or the message is too long.
+ */
+bool usart_send_segments(uint8_t channel, const usart_segment_t* segments, uint8_t count, uint16_t wait_ms);
+
+/**
+ * Returns or waits for the completion of the zero-copy message queued on the channel.
+ *
+ * @param channel Channel to check, it should be owned by the current task.
+ * @param wait_ms Maximum number of milliseconds to wait for the message to be sent.
+ *     Value of 0 will make this function non-blocking.
+ *     Value of @ref TIMER_INFINITE will make the the function block indefinitely
+ *     until the message is sent.
+ * @return True if there is no queued message, so the segments are free to reuse.
+ *     False if the message was still being sent when wait_ms elapsed.
+ */
+bool usart_wait_sent(uint8_t channel, uint16_t wait_ms);
 #endif
 
 #endif // NO_USART
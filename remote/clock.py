@@ -0,0 +1,115 @@
+"""Host side clock synchronization with the cube firmware.
+
+The cube timer is a 16-bit millisecond counter that wraps around every 65.5
+seconds. Timed frames of the streaming app carry a presentation time in timer
+units, so the host has to know how its own clock relates to the timer.
+
+It is estimated from a series of clock exchanges on the system channel, like
+NTP does: the host sends a request at t1, the cube receives it at t2 and
+replies at t3, and the host receives the reply at t4. See SYSTEM_COMMAND_CLOCK
+in firmware/src/system.h for the message format.
+"""
+
+import struct
+
+COMMAND_CLOCK = 0x08
+
+# Streaming app frame size, see firmware/src/cube.h
+FRAME_SIZE = 64
+
+_WRAP = 1 << 16
+
+
+def clock_request(sequence):
+    """Returns a clock exchange request payload, it is echoed in the reply."""
+    return struct.pack('<BH', COMMAND_CLOCK, sequence & 0xFFFF)
+
+
+def parse_clock_reply(payload):
+    """Returns a (sequence, t2, t3) tuple, or None if it is not a clock reply."""
+    if len(payload) != 7 or payload[0] != COMMAND_CLOCK:
+        return None
+    t2, t3, sequence = struct.unpack('<HHH', payload[1:])
+    return sequence, t2, t3
+
+
+def frame_message(frame, time=None, frame_id=None):
+    """Returns a streaming app message for a frame, with an optional
+    presentation time in cube timer units, and an optional 8-bit frame id that
+    the frame events report when the frame is displayed."""
+    if len(frame) != FRAME_SIZE:
+        raise ValueError('frame must be {} bytes'.format(FRAME_SIZE))
+    header = b''
+    if time is not None:
+        header += struct.pack('<H', int(time) % _WRAP)
+    if frame_id is not None:
+        header += bytes([frame_id & 0xFF])
+    return header + bytes(frame)
+
+
+class ClockSync:
+    """Estimates the offset and the drift of the cube timer.
+
+    Only the samples with the shortest round-trip delays are used, as those
+    are the least affected by queueing on the link, then the cube time is
+    fitted linearly to the host time with least squares.
+    """
+
+    def __init__(self, window=128, margin_ms=5.0):
+        self.window = window
+        self.margin = margin_ms
+        self.samples = []
+        self.offset = None
+        self.drift = 1.0
+        self.origin = 0.0
+
+    def add_sample(self, t1, t2, t3, t4):
+        """Adds the result of a clock exchange.
+
+        t1 and t4 are host times in milliseconds, t2 and t3 are the 16-bit
+        cube timer values from the reply.
+        """
+        host = (t1 + t4) / 2.0
+        delay = (t4 - t1) - ((t3 - t2) % _WRAP)
+        cube = self._unwrap(host, t2) + ((t3 - t2) % _WRAP) / 2.0
+        self.samples.append((host, cube, delay))
+        if len(self.samples) > self.window:
+            self.samples.pop(0)
+        self._fit()
+
+    def synchronized(self):
+        return self.offset is not None
+
+    def to_cube(self, host_ms):
+        """Returns the cube timer value that corresponds to a host time."""
+        if self.offset is None:
+            raise RuntimeError('no clock samples yet')
+        return int(round(self._predict(host_ms))) % _WRAP
+
+    def _predict(self, host_ms):
+        return self.offset + self.drift * (host_ms - self.origin)
+
+    def _unwrap(self, host, value):
+        # Take the unwrapped value that is the closest to the prediction
+        if self.offset is None:
+            return float(value)
+        predicted = self._predict(host)
+        delta = (value - predicted) % _WRAP
+        if delta >= _WRAP / 2:
+            delta -= _WRAP
+        return predicted + delta
+
+    def _fit(self):
+        shortest = min(delay for _, _, delay in self.samples)
+        good = [(h, c) for h, c, delay in self.samples if delay <= shortest + self.margin]
+        self.origin = good[-1][0]
+        if len(good) < 2:
+            self.offset = good[-1][1]
+            return
+        n = float(len(good))
+        mean_h = sum(h for h, _ in good) / n
+        mean_c = sum(c for _, c in good) / n
+        var = sum((h - mean_h) ** 2 for h, _ in good)
+        if var > 0:
+            self.drift = sum((h - mean_h) * (c - mean_c) for h, c in good) / var
+        self.offset = mean_c + self.drift * (self.origin - mean_h)
@@ -1,3 +1,4 @@
+import struct
 import time
 
 from PyQt5.QtCore import *
@@ -6,7 +7,7 @@ from PyQt5.QtGui import *
 from PyQt5.QtNetwork import *
 from PyQt5.QtBluetooth import *
 
-from crc8 import crc8
+import framing
 
 
 class CubeConnectionSpeed(QObject):
@@ -53,11 +54,17 @@ class CubeConnection(QObject):
 
     System = 0
     Application = 1
+    Event = 2
+
+    # Event channel records, see firmware/src/system.h
+    EventFrame = 0x01
+    EventRecordSize = 6
 
     sysDataReceived = pyqtSignal()
     appDataReceived = pyqtSignal()
     sysDataSent = pyqtSignal()
     appDataSent = pyqtSignal()
+    frameShown = pyqtSignal(int, int, int)
 
     def __init__(self, parent=None):
         super().__init__(parent)
@@ -75,6 +82,7 @@ class CubeConnection(QObject):
         self.readBuffer = QByteArray()
         self.sysDataToRead = QByteArray()
         self.appDataToRead = QByteArray()
+        self.eventData = bytearray()
         self.writeBuffer = QByteArray()
 
         self.speed = CubeConnectionSpeed(10)
@@ -127,7 +135,7 @@ class CubeConnection(QObject):
         received = set()
         self.readBuffer.append(self.socket.readAll())
         while not self.readBuffer.isEmpty():
-            end = self.readBuffer.indexOf(b'\x7E')
+            end = self.readBuffer.indexOf(framing.delimiter())
             if end == -1:
                 break
             elif end == 0:
@@ -136,25 +144,34 @@ class CubeConnection(QObject):
             else:
                 frame = self.readBuffer.left(end)
                 self.readBuffer.remove(0, end + 1)
-                frameAddress = (ord(frame.at(0)) & 0x80) >> 7
-                frameLength = ord(frame.at(0)) & 0x7F
-                frame.replace(b'\x7D\x5E', b'\x7E')
-                frame.replace(b'\x7D\x5D', b'\x7E')
-                frameChecksum = crc8(frame.data()).digest()[0]
-                if frame.size() != frameLength and frameChecksum != 0:
-                    qDebug('Frame {}: addr {}, len {}, crc {} not ok'.format(frame.toHex(), frameAddress, frameLength, frameChecksum))
+                decoded = framing.decode(frame.data())
+                if decoded is None:
+                    qDebug('Frame {}: not ok'.format(frame.toHex()))
                     continue
-                if frameAddress == CubeConnection.System:
-                    self.sysDataToRead += frame.mid(1, frameLength)
-                    qDebug('Sys frame {}: len {}, crc {} ok, buf {}'.format(frame.toHex(), frameLength, frameChecksum, len(self.sysDataToRead)))
+                frameChannel, payload = decoded
+                if frameChannel == CubeConnection.System:
+                    self.sysDataToRead += QByteArray(payload)
+                    qDebug('Sys frame {}: len {} ok, buf {}'.format(frame.toHex(), len(payload), len(self.sysDataToRead)))
                     received.add(CubeConnection.System)
-                else:
-                    self.appDataToRead += frame.mid(1, frameLength)
-                    qDebug('App frame {}: len {}, crc {} ok, buf {}'.format(frame.toHex(), frameLength, frameChecksum, len(self.appDataToRead)))
+                elif frameChannel == CubeConnection.Application:
+                    self.appDataToRead += QByteArray(payload)
+                    qDebug('App frame {}: len {} ok, buf {}'.format(frame.toHex(), len(payload), len(self.appDataToRead)))
                     received.add(CubeConnection.Application)
+                elif frameChannel == CubeConnection.Event:
+                    self.eventData += payload
+                    self.processEvents()
+                else:
+                    qDebug('Frame {}: unknown chan {}'.format(frame.toHex(), frameChannel))
 
         if CubeConnection.System in received:
             self.sysDataReceived.emit()
         if CubeConnection.Application in received:
             self.appDataReceived.emit()
 
+    def processEvents(self):
+        size = CubeConnection.EventRecordSize
+        while len(self.eventData) >= size:
+            kind, sequence, timestamp, frameId = struct.unpack('<BHHB', bytes(self.eventData[:size]))
+            del self.eventData[:size]
+            if kind == CubeConnection.EventFrame:
+                self.frameShown.emit(sequence, timestamp, frameId)
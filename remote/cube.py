@@ -1,15 +1,14 @@
-#!/usr/bin/env python
+#!/usr/bin/env python3
 
-from crc8 import crc8
 from socket import socket, AF_INET, SOCK_STREAM
 from sys import argv
 
-def wrap_message(data):
-    msg = chr(128 + len(data)) + data
-    msg = msg + crc8(msg).digest()
-    msg = msg.replace(chr(0x7E), '\x7D\x5E').replace(chr(0x7D), '\x7D\x5D')
-    msg = chr(0x7E) + msg + chr(0x7E)
-    return msg
+import framing
+
+APP_CHANNEL = 1
+
+def wrap_message(data, channel=APP_CHANNEL):
+    return framing.encode(channel, data)
 
 def send_message(msg):
     sock = socket(AF_INET, SOCK_STREAM)
@@ -18,19 +17,20 @@ def send_message(msg):
     sock.close()
 
 def unwrap_message(msg):
-    s = msg.find(chr(0x7E),0)
+    delimiter = framing.delimiter()
+    s = msg.find(delimiter, 0)
     if s < 0:
         return msg
-    e = msg.find(chr(0x7E),s+1)
+    e = msg.find(delimiter, s + 1)
     if e < 0:
         return msg[s:]
-    if e - s < 3:
+    if e - s < 2:
         return msg[e:]
-    data = msg[s+1:e].replace('\x7D\x5E', chr(0x7E)).replace('\x7D\x5D', chr(0x7D))
-    if (ord(data[0]) - 128 != len(data) - 2) or (data[-1] != crc8(data[:-1]).digest()):
-        print(ord(data[0]), len(data), ':'.join('{:02x}'.format(ord(c)) for c in data))
+    frame = framing.decode(msg[s+1:e])
+    if frame is None:
+        print(':'.join('{:02x}'.format(c) for c in msg[s+1:e]))
     else:
-        print('\n'.join('{:08b}'.format(ord(c))[::-1] for c in data[1:-1]))
+        print('\n'.join('{:08b}'.format(c)[::-1] for c in frame[1]))
     print('')
     return msg[e:]
 
@@ -46,6 +46,6 @@ def recv_message():
 
 if __name__ == '__main__':
     if argv[1] == 'send':
-        send_message(wrap_message(argv[2][:127] if len(argv) > 1 else ''))
+        send_message(wrap_message(argv[2].encode('latin-1')[:255] if len(argv) > 2 else b''))
     elif argv[1] == 'recv':
         recv_message()
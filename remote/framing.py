@@ -0,0 +1,106 @@
+"""Host side of the USART framing of the cube firmware.
+
+A frame consists of a channel byte, a length byte, the payload and a CRC-8
+footer, which is then either HDLC byte-stuffed or COBS encoded, and delimited
+by frame bytes. See firmware/src/usart.c for the details.
+"""
+
+from crc8 import crc8
+
+HDLC = 'hdlc'
+COBS = 'cobs'
+
+# It must match the FRAMING setting the firmware was built with
+FRAMING = HDLC
+
+_HDLC_FRAME = 0x7E
+_HDLC_ESCAPE = 0x7D
+_HDLC_MASK = 0x20
+_COBS_FRAME = 0x00
+_COBS_BLOCK_MAX = 0xFF
+
+
+def delimiter(framing=FRAMING):
+    """Returns the frame delimiter byte of the framing."""
+    return bytes([_COBS_FRAME if framing == COBS else _HDLC_FRAME])
+
+
+def _cobs_encode(data):
+    out = bytearray()
+    block = bytearray()
+    for byte in data:
+        if byte == 0:
+            out.append(len(block) + 1)
+            out += block
+            block = bytearray()
+        else:
+            block.append(byte)
+            if len(block) == _COBS_BLOCK_MAX - 1:
+                out.append(_COBS_BLOCK_MAX)
+                out += block
+                block = bytearray()
+    out.append(len(block) + 1)
+    out += block
+    return bytes(out)
+
+
+def _cobs_decode(data):
+    out = bytearray()
+    i = 0
+    zero = False
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        if zero:
+            out.append(0)
+        out += data[i + 1:i + code]
+        zero = code != _COBS_BLOCK_MAX
+        i += code
+    return bytes(out)
+
+
+def _hdlc_encode(data):
+    out = bytearray()
+    for byte in data:
+        if byte in (_HDLC_FRAME, _HDLC_ESCAPE):
+            out.append(_HDLC_ESCAPE)
+            out.append(byte ^ _HDLC_MASK)
+        else:
+            out.append(byte)
+    return bytes(out)
+
+
+def _hdlc_decode(data):
+    out = bytearray()
+    escape = False
+    for byte in data:
+        if escape:
+            out.append(byte ^ _HDLC_MASK)
+            escape = False
+        elif byte == _HDLC_ESCAPE:
+            escape = True
+        else:
+            out.append(byte)
+    return None if escape else bytes(out)
+
+
+def encode(channel, payload, framing=FRAMING):
+    """Returns the delimited frame that sends the payload on the channel."""
+    data = bytes([channel, len(payload)]) + bytes(payload)
+    data += crc8(data).digest()
+    data = _cobs_encode(data) if framing == COBS else _hdlc_encode(data)
+    return delimiter(framing) + data + delimiter(framing)
+
+
+def decode(frame, framing=FRAMING):
+    """Decodes a frame without its delimiters.
+
+    Returns a (channel, payload) tuple, or None if the frame is malformed.
+    """
+    data = _cobs_decode(frame) if framing == COBS else _hdlc_decode(frame)
+    if data is None or len(data) < 3 or data[1] != len(data) - 3:
+        return None
+    if crc8(data).digest()[0] != 0:
+        return None
+    return data[0], data[2:-1]
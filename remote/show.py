@@ -0,0 +1,92 @@
+"""Host side encoder of the shows played by the player app from flash.
+
+A show is a looped animation: frames of 64 bytes with their hold times in
+frame periods. It is encoded as XOR differences of the frames, run-length
+encoded, and uploaded page by page. See firmware/src/app_player.h for the
+format and the messages.
+"""
+
+import struct
+
+MAGIC = 0x53
+FORMAT = 1
+HEADER_SIZE = 8
+FRAME_SIZE = 64
+
+# Storage area of the firmware, see firmware/src/flash.h
+PAGE_SIZE = 128
+STORE_SIZE = 0x2000
+
+MESSAGE_WRITE = 0x01
+MESSAGE_PLAY = 0x02
+
+_LITERAL_MAX = 0x80
+_SKIP_MAX = 0x80
+
+
+def crc16(data):
+    """CRC-16/CCITT, reflected, starting from 0xFFFF like _crc_ccitt_update()."""
+    crc = 0xFFFF
+    for byte in data:
+        byte ^= crc & 0xFF
+        byte ^= (byte << 4) & 0xFF
+        crc = ((byte << 8) | (crc >> 8)) ^ (byte >> 4) ^ (byte << 3)
+        crc &= 0xFFFF
+    return crc
+
+
+def _encode_frame(previous, frame, hold):
+    delta = bytes(a ^ b for a, b in zip(previous, frame))
+    out = bytearray([hold])
+    pos = 0
+    while pos < FRAME_SIZE:
+        end = pos
+        if delta[pos] == 0:
+            while end < FRAME_SIZE and delta[end] == 0 and end - pos < _SKIP_MAX:
+                end += 1
+            out.append(0x7F + end - pos)
+        else:
+            # Keep single unchanged bytes in literals, a skip token costs as much
+            while end < FRAME_SIZE and end - pos < _LITERAL_MAX:
+                if delta[end] == 0 and (end + 1 >= FRAME_SIZE or delta[end + 1] == 0):
+                    break
+                end += 1
+            out.append(end - pos - 1)
+            out += delta[pos:end]
+        pos = end
+    return bytes(out)
+
+
+def encode(frames):
+    """Encodes a show from a list of (frame, hold) tuples, returns its image."""
+    if not frames:
+        raise ValueError('a show needs at least one frame')
+    data = bytearray()
+    previous = bytes(FRAME_SIZE)
+    for frame, hold in frames:
+        if len(frame) != FRAME_SIZE:
+            raise ValueError('frames must be {} bytes'.format(FRAME_SIZE))
+        data += _encode_frame(previous, bytes(frame), max(1, min(255, hold)))
+        previous = bytes(frame)
+    if HEADER_SIZE + len(data) > STORE_SIZE:
+        raise ValueError('the show does not fit into the storage')
+    header = struct.pack('<BBHHH', MAGIC, FORMAT, len(frames), len(data), crc16(data))
+    return header + bytes(data)
+
+
+def write_messages(image):
+    """Returns the app channel messages that upload a show image.
+
+    Each one must be sent only after the reply to the previous one arrived.
+    """
+    messages = []
+    for page in range((len(image) + PAGE_SIZE - 1) // PAGE_SIZE):
+        chunk = image[page * PAGE_SIZE:(page + 1) * PAGE_SIZE]
+        chunk += bytes([0xFF]) * (PAGE_SIZE - len(chunk))
+        messages.append(bytes([MESSAGE_WRITE, page]) + chunk)
+    return messages
+
+
+def play_message():
+    """Returns the app channel message that starts the uploaded show."""
+    return bytes([MESSAGE_PLAY])